@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "adaptive_rate.h"
+#include "frame_ring.h"
+
+/**
+ * @brief How often the control thread re-evaluates the frame rate
+ */
+#define CONTROL_PERIOD_MS (100)
+
+/**
+ * @brief Default activity threshold as mean absolute luma difference
+ */
+#define DEFAULT_THRESHOLD (2.0)
+
+/**
+ * @brief Default time without activity before the rate is lowered
+ */
+#define DEFAULT_QUIET_MS (30 * 1000)
+
+/**
+ * @brief Bumped by @c adaptive_rate_trigger_all; each controller remembers the last value it saw
+ */
+static atomic_uint triggerCount;
+
+static uint64_t nowMs(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Changes the viewfinder frame rate, stopping the viewfinder if the camera requires it
+ */
+static int setFrameRate(AdaptiveRate* rate, double fps)
+{
+    int err = camera_set_vf_property(rate->handle, CAMERA_IMGPROP_FRAMERATE, fps);
+    if (err != CAMERA_EOK) {
+        // Some cameras only accept a new frame rate while the viewfinder is stopped
+        err = camera_stop_viewfinder(rate->handle);
+        if (err == CAMERA_EOK) {
+            err = camera_set_vf_property(rate->handle, CAMERA_IMGPROP_FRAMERATE, fps);
+            int startErr = camera_start_viewfinder(rate->handle, rate->callback, NULL, rate->callback_arg);
+            if (err == CAMERA_EOK) {
+                err = startErr;
+            }
+        }
+    }
+    if (err != CAMERA_EOK) {
+        printf("\r\nFailed to set frame rate to %.1f fps: err = %d\n", fps, err);
+    } else {
+        printf("\r\nFrame rate set to %.1f fps\n", fps);
+    }
+    return err;
+}
+
+static void* controlThread(void* arg)
+{
+    AdaptiveRate* rate = (AdaptiveRate*)arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&rate->lock);
+    while (atomic_load(&rate->running)) {
+        if (!atomic_exchange(&rate->wake, false)) {
+            (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += CONTROL_PERIOD_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            (void)pthread_cond_timedwait(&rate->changed, &rate->lock, &deadline);
+            atomic_store(&rate->wake, false);
+            if (!atomic_load(&rate->running)) {
+                break;
+            }
+        }
+
+        uint64_t now = nowMs();
+        unsigned triggers = atomic_load(&triggerCount);
+        if (atomic_exchange(&rate->triggered, false) || (triggers != rate->seen_triggers)) {
+            rate->seen_triggers = triggers;
+            atomic_store(&rate->last_active_ms, now);
+        }
+        uint64_t last_active = atomic_load(&rate->last_active_ms);
+        bool quiet = (now >= last_active) && ((now - last_active) >= rate->config.quiet_ms);
+        bool low = atomic_load(&rate->low);
+        if (low == quiet) {
+            continue;
+        }
+
+        // Talking to the camera service can take a while; don't hold up triggers
+        pthread_mutex_unlock(&rate->lock);
+        if (setFrameRate(rate, quiet ? rate->config.low_fps : rate->full_fps) == CAMERA_EOK) {
+            atomic_store(&rate->low, quiet);
+        }
+        pthread_mutex_lock(&rate->lock);
+    }
+    pthread_mutex_unlock(&rate->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Wakes the control thread so it re-evaluates the frame rate right away
+ */
+static void wakeControl(AdaptiveRate* rate)
+{
+    pthread_mutex_lock(&rate->lock);
+    atomic_store(&rate->wake, true);
+    pthread_cond_signal(&rate->changed);
+    pthread_mutex_unlock(&rate->lock);
+}
+
+int adaptive_rate_parse(const char* spec, AdaptiveRateConfig* config)
+{
+    char* end;
+
+    config->low_fps = strtod(spec, &end);
+    config->threshold = DEFAULT_THRESHOLD;
+    config->quiet_ms = DEFAULT_QUIET_MS;
+    if ((end == spec) || (config->low_fps <= 0.0)) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char* field = end + 1;
+        config->threshold = strtod(field, &end);
+        if ((end == field) || (config->threshold < 0.0)) {
+            return -1;
+        }
+    }
+    if (*end == ':') {
+        const char* field = end + 1;
+        double seconds = strtod(field, &end);
+        if ((end == field) || (seconds < 0.0)) {
+            return -1;
+        }
+        config->quiet_ms = (uint32_t)(seconds * 1000.0);
+    }
+    return (*end == '\0') ? 0 : -1;
+}
+
+int adaptive_rate_start(AdaptiveRate* rate, const AdaptiveRateConfig* config, camera_handle_t handle,
+                        AdaptiveRateCallback callback, void* arg)
+{
+    pthread_condattr_t condAttr;
+
+    memset(rate, 0, sizeof(*rate));
+    rate->config = *config;
+    rate->handle = handle;
+    rate->callback = callback;
+    rate->callback_arg = arg;
+    rate->seen_triggers = atomic_load(&triggerCount);
+    atomic_init(&rate->last_active_ms, nowMs());
+    atomic_init(&rate->low, false);
+    atomic_init(&rate->wake, false);
+    atomic_init(&rate->triggered, false);
+    atomic_init(&rate->running, true);
+
+    int err = camera_get_vf_property(handle, CAMERA_IMGPROP_FRAMERATE, &rate->full_fps);
+    if ((err != CAMERA_EOK) || (rate->full_fps <= rate->config.low_fps)) {
+        printf("Not adapting frame rate: err = %d, current rate %.1f fps\n", err, rate->full_fps);
+        return -1;
+    }
+
+    pthread_mutex_init(&rate->lock, NULL);
+    (void)pthread_condattr_init(&condAttr);
+    (void)pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&rate->changed, &condAttr);
+    (void)pthread_condattr_destroy(&condAttr);
+    if (pthread_create(&rate->thread, NULL, controlThread, rate) != 0) {
+        printf("Failed to create frame rate control thread\n");
+        pthread_cond_destroy(&rate->changed);
+        pthread_mutex_destroy(&rate->lock);
+        return -1;
+    }
+    return 0;
+}
+
+void adaptive_rate_observe(AdaptiveRate* rate, const camera_buffer_t* buffer)
+{
+    uint32_t width = 0, height = 0, stride = 0;
+    uint32_t pixelBytes;
+    uint32_t lumaOffset;
+
+    // Sample one luma-like byte per pixel: green for RGB, Y for YUV
+    switch (buffer->frametype) {
+    case CAMERA_FRAMETYPE_RGB8888:
+    case CAMERA_FRAMETYPE_BGR8888:
+        pixelBytes = 4;
+        lumaOffset = 1;
+        break;
+    case CAMERA_FRAMETYPE_YCBYCR:
+        pixelBytes = 2;
+        lumaOffset = 0;
+        break;
+    case CAMERA_FRAMETYPE_CBYCRY:
+        pixelBytes = 2;
+        lumaOffset = 1;
+        break;
+    default:
+        return;
+    }
+    frame_get_dimensions(buffer->frametype, &buffer->framedesc, &width, &height, &stride);
+    if ((width < ADAPTIVE_RATE_GRID) || (height < ADAPTIVE_RATE_GRID)) {
+        return;
+    }
+
+    uint32_t difference = 0;
+    for (uint32_t gy = 0; gy < ADAPTIVE_RATE_GRID; gy++) {
+        const uint8_t* line = buffer->framebuf + (size_t)((2 * gy + 1) * height / (2 * ADAPTIVE_RATE_GRID)) * stride;
+        for (uint32_t gx = 0; gx < ADAPTIVE_RATE_GRID; gx++) {
+            uint32_t x = (2 * gx + 1) * width / (2 * ADAPTIVE_RATE_GRID);
+            uint8_t sample = line[x * pixelBytes + lumaOffset];
+            uint8_t* previous = &rate->previous[gy * ADAPTIVE_RATE_GRID + gx];
+            difference += (sample > *previous) ? (uint32_t)(sample - *previous) : (uint32_t)(*previous - sample);
+            *previous = sample;
+        }
+    }
+    if (!rate->has_previous) {
+        rate->has_previous = true;
+        return;
+    }
+
+    double activity = (double)difference / (ADAPTIVE_RATE_GRID * ADAPTIVE_RATE_GRID);
+    if (activity >= rate->config.threshold) {
+        atomic_store(&rate->last_active_ms, nowMs());
+        if (atomic_load(&rate->low)) {
+            wakeControl(rate);
+        }
+    }
+}
+
+void adaptive_rate_trigger(AdaptiveRate* rate)
+{
+    atomic_store(&rate->triggered, true);
+    wakeControl(rate);
+}
+
+void adaptive_rate_trigger_all(void)
+{
+    atomic_fetch_add(&triggerCount, 1);
+}
+
+void adaptive_rate_stop(AdaptiveRate* rate)
+{
+    pthread_mutex_lock(&rate->lock);
+    atomic_store(&rate->running, false);
+    pthread_cond_signal(&rate->changed);
+    pthread_mutex_unlock(&rate->lock);
+    pthread_join(rate->thread, NULL);
+
+    if (atomic_load(&rate->low)) {
+        (void)setFrameRate(rate, rate->full_fps);
+        atomic_store(&rate->low, false);
+    }
+    pthread_cond_destroy(&rate->changed);
+    pthread_mutex_destroy(&rate->lock);
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ADAPTIVE_RATE_H
+#define ADAPTIVE_RATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <camera/camera_api.h>
+
+/**
+ * @brief Number of pixels sampled per axis to measure frame-to-frame change
+ */
+#define ADAPTIVE_RATE_GRID (32)
+
+/**
+ * @brief When and how far the viewfinder frame rate is lowered
+ *
+ * The rate drops to @c low_fps once the mean absolute difference between the
+ * luma samples of consecutive frames has stayed below @c threshold (0-255)
+ * for @c quiet_ms. A @c low_fps of 0 disables adaptation.
+ */
+typedef struct {
+    double low_fps;
+    double threshold;
+    uint32_t quiet_ms;
+} AdaptiveRateConfig;
+
+/**
+ * @brief Viewfinder callback that is restarted when the frame rate can only change while stopped
+ */
+typedef void (*AdaptiveRateCallback)(camera_handle_t handle, camera_buffer_t* buffer, void* arg);
+
+/**
+ * @brief Frame rate controller of one camera
+ *
+ * The camera callback feeds every frame to @c adaptive_rate_observe; a
+ * control thread changes the frame rate so the callback never blocks on the
+ * camera service.
+ */
+typedef struct {
+    AdaptiveRateConfig config;
+    camera_handle_t handle;
+    AdaptiveRateCallback callback;
+    void* callback_arg;
+    double full_fps;
+    uint8_t previous[ADAPTIVE_RATE_GRID * ADAPTIVE_RATE_GRID];
+    bool has_previous;
+    atomic_uint_fast64_t last_active_ms;
+    atomic_bool low;
+    atomic_bool wake;
+    atomic_bool triggered;
+    unsigned seen_triggers;
+    atomic_bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} AdaptiveRate;
+
+/**
+ * @brief Parses "<low_fps>[:<threshold>[:<quiet_s>]]", e.g. "2:1.5:30"
+ *
+ * @return 0 on success, -1 if @c spec is malformed
+ */
+int adaptive_rate_parse(const char* spec, AdaptiveRateConfig* config);
+
+/**
+ * @brief Starts the control thread for a camera
+ *
+ * Called before the viewfinder is started, so the callback can observe frames
+ * from the first one. The camera must have been opened with @c CAMERA_MODE_RW.
+ *
+ * @param rate Controller state
+ * @param config Adaptation settings
+ * @param handle Camera handle
+ * @param callback Viewfinder callback the viewfinder is started with
+ * @param arg Argument the viewfinder is started with
+ * @return 0 on success, -1 on failure
+ */
+int adaptive_rate_start(AdaptiveRate* rate, const AdaptiveRateConfig* config, camera_handle_t handle,
+                        AdaptiveRateCallback callback, void* arg);
+
+/**
+ * @brief Measures the change against the previous frame; called from the camera callback
+ */
+void adaptive_rate_observe(AdaptiveRate* rate, const camera_buffer_t* buffer);
+
+/**
+ * @brief Restores the full frame rate of one camera as soon as possible
+ */
+void adaptive_rate_trigger(AdaptiveRate* rate);
+
+/**
+ * @brief Restores the full frame rate of every camera; async-signal-safe
+ */
+void adaptive_rate_trigger_all(void);
+
+/**
+ * @brief Stops the control thread and restores the full frame rate
+ *
+ * Must be called before the viewfinder is stopped for good, since the
+ * control thread may restart it.
+ */
+void adaptive_rate_stop(AdaptiveRate* rate);
+
+#endif
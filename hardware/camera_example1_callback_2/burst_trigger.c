@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/neutrino.h>
+#include "public/rpi_gpio.h"
+#include "burst_trigger.h"
+#include "adaptive_rate.h"
+
+/**
+ * @brief Event ID the GPIO resource manager puts in the pulse value
+ */
+#define BURST_EVENT_ID (0x6275)
+
+/**
+ * @brief Pulse code the GPIO resource manager uses for events
+ */
+#define BURST_PULSE_GPIO (_PULSE_CODE_MINAVAIL)
+
+/**
+ * @brief Pulse code that ends the pulse thread
+ */
+#define BURST_PULSE_STOP (_PULSE_CODE_MINAVAIL + 1)
+
+/**
+ * @brief Default burst length
+ */
+#define DEFAULT_DURATION_MS (10 * 1000)
+
+static uint64_t nowNs(void)
+{
+    struct timespec now;
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+static void* pulseThread(void* arg)
+{
+    BurstTrigger* trigger = (BurstTrigger*)arg;
+    uint64_t burst_end = 0;
+    struct _pulse pulse;
+
+    for (;;) {
+        // While a burst is running, only wait until it is due to end
+        if (atomic_load(&trigger->active)) {
+            uint64_t now = nowNs();
+            uint64_t timeout = (burst_end > now) ? (burst_end - now) : 0;
+            (void)TimerTimeout(CLOCK_MONOTONIC, _NTO_TIMEOUT_RECEIVE, NULL, &timeout, NULL);
+        }
+        if (MsgReceivePulse(trigger->chid, &pulse, sizeof(pulse), NULL) == -1) {
+            if (errno == ETIMEDOUT) {
+                if (nowNs() >= burst_end) {
+                    atomic_store(&trigger->active, false);
+                }
+                continue;
+            }
+            perror("MsgReceivePulse");
+            break;
+        }
+
+        if (pulse.code == BURST_PULSE_STOP) {
+            break;
+        }
+        if ((pulse.code != BURST_PULSE_GPIO) || (pulse.value.sival_int != BURST_EVENT_ID)) {
+            continue;
+        }
+
+        // Every edge (re)starts the burst window; cameras go back to full rate
+        burst_end = nowNs() + (uint64_t)trigger->config.duration_ms * 1000000ULL;
+        if (!atomic_exchange(&trigger->active, true)) {
+            trigger->bursts++;
+            printf("\r\nBurst %llu triggered on GPIO%d\n", (unsigned long long)trigger->bursts, trigger->config.pin);
+        }
+        adaptive_rate_trigger_all();
+    }
+
+    atomic_store(&trigger->active, false);
+    return NULL;
+}
+
+int burst_trigger_parse(const char* spec, BurstConfig* config)
+{
+    char* end;
+
+    config->pin = (int)strtol(spec, &end, 10);
+    config->edge = GPIO_RISING;
+    config->duration_ms = DEFAULT_DURATION_MS;
+    if ((end == spec) || (config->pin < 0) || (config->pin >= GPIO_COUNT)) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char* edge = end + 1;
+        size_t length = strcspn(edge, ":");
+        if ((length == 6) && (strncmp(edge, "rising", length) == 0)) {
+            config->edge = GPIO_RISING;
+        } else if ((length == 7) && (strncmp(edge, "falling", length) == 0)) {
+            config->edge = GPIO_FALLING;
+        } else if ((length == 4) && (strncmp(edge, "both", length) == 0)) {
+            config->edge = GPIO_RISING | GPIO_FALLING;
+        } else {
+            return -1;
+        }
+        end = (char*)edge + length;
+    }
+    if (*end == ':') {
+        const char* field = end + 1;
+        double seconds = strtod(field, &end);
+        if ((end == field) || (seconds <= 0.0)) {
+            return -1;
+        }
+        config->duration_ms = (uint32_t)(seconds * 1000.0);
+    }
+    return (*end == '\0') ? 0 : -1;
+}
+
+int burst_trigger_start(BurstTrigger* trigger, const BurstConfig* config)
+{
+    memset(trigger, 0, sizeof(*trigger));
+    trigger->config = *config;
+    trigger->coid = -1;
+    atomic_init(&trigger->active, false);
+
+    trigger->chid = ChannelCreate(_NTO_CHF_PRIVATE);
+    if (trigger->chid == -1) {
+        perror("ChannelCreate");
+        return -1;
+    }
+    trigger->coid = ConnectAttach(0, 0, trigger->chid, _NTO_SIDE_CHANNEL, 0);
+    if (trigger->coid == -1) {
+        perror("ConnectAttach");
+        ChannelDestroy(trigger->chid);
+        return -1;
+    }
+
+    if (rpi_gpio_setup(config->pin, GPIO_IN) != GPIO_SUCCESS) {
+        printf("Failed to configure GPIO%d as input\n", config->pin);
+        goto fail;
+    }
+    if (rpi_gpio_add_event_detect(config->pin, trigger->coid, config->edge, BURST_EVENT_ID) != GPIO_SUCCESS) {
+        printf("Failed to subscribe to GPIO%d events\n", config->pin);
+        goto fail;
+    }
+    if (pthread_create(&trigger->thread, NULL, pulseThread, trigger) != 0) {
+        printf("Failed to create burst trigger thread\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    ConnectDetach(trigger->coid);
+    ChannelDestroy(trigger->chid);
+    trigger->coid = -1;
+    return -1;
+}
+
+void burst_trigger_stop(BurstTrigger* trigger)
+{
+    if (trigger->coid == -1) {
+        return;
+    }
+    (void)MsgSendPulse(trigger->coid, -1, BURST_PULSE_STOP, 0);
+    pthread_join(trigger->thread, NULL);
+    ConnectDetach(trigger->coid);
+    ChannelDestroy(trigger->chid);
+    trigger->coid = -1;
+    (void)rpi_gpio_cleanup();
+}
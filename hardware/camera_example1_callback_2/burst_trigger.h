@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BURST_TRIGGER_H
+#define BURST_TRIGGER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * @brief GPIO pin and edge that start a burst, and how long a burst lasts
+ *
+ * @c edge is a combination of GPIO_RISING and GPIO_FALLING.
+ */
+typedef struct {
+    int pin;
+    unsigned edge;
+    uint32_t duration_ms;
+} BurstConfig;
+
+/**
+ * @brief Burst capture driven by a GPIO edge
+ *
+ * The GPIO resource manager delivers a pulse for every matching edge. Each
+ * pulse sets @c active for @c duration_ms (extended by further edges); stages
+ * whose @c StageRate::full_rate points at @c active then run on every frame,
+ * and fall back to their own rate afterwards.
+ */
+typedef struct {
+    BurstConfig config;
+    int chid;
+    int coid;
+    pthread_t thread;
+    atomic_bool active;
+    uint64_t bursts;
+} BurstTrigger;
+
+/**
+ * @brief Parses "<pin>[:<rising|falling|both>[:<seconds>]]", e.g. "17:rising:20"
+ *
+ * @return 0 on success, -1 if @c spec is malformed
+ */
+int burst_trigger_parse(const char* spec, BurstConfig* config);
+
+/**
+ * @brief Configures the pin as input, subscribes to its edges and starts the pulse thread
+ *
+ * @return 0 on success, -1 on failure
+ */
+int burst_trigger_start(BurstTrigger* trigger, const BurstConfig* config);
+
+/**
+ * @brief Stops the pulse thread and ends any burst in progress
+ */
+void burst_trigger_stop(BurstTrigger* trigger);
+
+#endif
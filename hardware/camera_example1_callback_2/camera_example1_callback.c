@@ -22,42 +22,28 @@
 #include <termios.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <errno.h>
+#include <signal.h>
 #include <sys/mman.h>
 #include <fcntl.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <jpeglib.h>
-
-int compress_to_jpeg(uint8_t* rgb_data, int width, int height, uint8_t** jpeg_data, unsigned long* jpeg_size) {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    jpeg_mem_dest(&cinfo, jpeg_data, jpeg_size);
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 75, TRUE);
-    jpeg_start_compress(&cinfo, TRUE);
-    while (cinfo.next_scanline < cinfo.image_height) {
-        row_pointer[0] = &rgb_data[cinfo.next_scanline * width * 3];
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
-    }
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    return 1;
-}
-
 #include <camera/camera_api.h>
+#include "camera_pipeline.h"
+#include "burst_trigger.h"
+
+/**
+ * @brief Default size of the flight recorder data ring in MiB
+ */
+#define DEFAULT_RECORDER_MB (256)
+
+/**
+ * @brief Host that receives the JPEG streams
+ */
+#define STREAM_HOST "192.168.1.100" // Change to host IP
 
 /**
- * @brief Number of channels for supported frametypes
+ * @brief Port of the first unit's JPEG stream; further units use the following ports
  */
-#define NUM_CHANNELS (3)
+#define STREAM_BASE_PORT (5001)
 
 /**
  * @brief List of frametypes that @c processCameraData can operate on
@@ -70,33 +56,10 @@ const camera_frametype_t cSupportedFrametypes[] = {
 };
 #define NUM_SUPPORTED_FRAMETYPES (sizeof(cSupportedFrametypes) / sizeof(cSupportedFrametypes[0]))
 
-typedef struct {
-    camera_frametype_t frametype;
-    camera_framedesc_t framedesc;
-    char* shm_name;
-    uint8_t* mapped_data;
-    size_t data_size;
-} Frame;
-
-typedef struct {
-    camera_frametype_t frametype;
-    uint32_t width;
-    uint32_t height;
-    size_t size;
-} Metadata;
-
-#define MAX_FRAMES 5
-static Frame frame_buffer[MAX_FRAMES];
-static int buffer_head = 0;
-static int buffer_count = 0;
-static pthread_mutex_t frame_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static Metadata* metadata_mapped = NULL;
-static int metadata_fd = -1;
-static char* latest_shm_name = NULL;
-static uint8_t* latest_mapped = NULL;
-static size_t latest_size = 0;
-static int sock = -1;
+static CameraPipeline pipelines[MAX_PIPELINES];
+static int num_pipelines = 0;
+static FlightRecorder extract_recorder;
+static BurstTrigger burst_trigger;
 
 /**
  * @brief Prints a list of available cameras
@@ -118,14 +81,66 @@ static void processCameraData(camera_handle_t handle, camera_buffer_t* buffer, v
 static void blockOnKeyPress(void);
 
 /**
- * @brief Calculates the size of the frame data in bytes
+ * @brief Feeds every frame of a capture file through @c processCameraData
+ *
+ * @param pipeline Pipeline the frames are delivered to
+ * @param path Capture file written with the -c option
+ * @return 0 on success, -1 on failure
  */
-static size_t get_frame_size(camera_buffer_t* buffer);
+static int replayCapture(CameraPipeline* pipeline, const char* path);
+
+/**
+ * @brief Prints every frame description published on a metadata page
+ *
+ * Opens the page again whenever its writer stops or restarts, and runs until
+ * the process is interrupted.
+ *
+ * @param name Shared memory object name of the page
+ * @return -1 if waiting on the page fails
+ */
+static int watchMetadata(const char* name);
+
+/**
+ * @brief Opens a camera unit and checks that it defaults to a supported frametype
+ *
+ * @param unit Camera unit to open
+ * @param mode CAMERA_MODE_RO, or CAMERA_MODE_RW when the frame rate is adapted
+ * @param handle Receives the camera handle; left invalid on failure
+ * @param width Receives the viewfinder width
+ * @param height Receives the viewfinder height
+ * @return 0 on success, -1 on failure
+ */
+static int openCamera(camera_unit_t unit, camera_mode_t mode, camera_handle_t* handle, uint32_t* width,
+                      uint32_t* height);
 
 /**
- * @brief Returns the most recent frame from the buffer
+ * @brief SIGUSR1 handler restoring the full frame rate of every camera
  */
-static Frame* get_latest_frame(void);
+static void onRateTrigger(int signo);
+
+/**
+ * @brief Parses a "<thread>=<policy>:<priority>[:<cpu_mask>]" option into the unit's scheduling
+ *
+ * @return 0 on success, -1 if the option is malformed
+ */
+static int parseSchedOption(const char* option, ThreadSchedConfig* sched);
+
+/**
+ * @brief Parses a "<stage>=<n>" or "<stage>=<hz>hz" option into the stage rates
+ *
+ * @return 0 on success, -1 if the option is malformed
+ */
+static int parseRateOption(const char* option, StageRate* rates);
+
+/**
+ * @brief Appends a per-unit suffix to a file path when several units are configured
+ */
+static const char* unitPath(const char* path, camera_unit_t unit, char* storage, size_t size);
+
+/**
+ * @brief Calculates the size of the frame data in bytes
+ */
+static size_t get_frame_size(camera_buffer_t* buffer);
 
 static size_t get_frame_size(camera_buffer_t* buffer) {
     switch (buffer->frametype) {
@@ -142,30 +157,121 @@ static size_t get_frame_size(camera_buffer_t* buffer) {
     }
 }
 
-static Frame* get_latest_frame(void) {
-    pthread_mutex_lock(&frame_mutex);
-    if (buffer_count == 0) {
-        pthread_mutex_unlock(&frame_mutex);
-        return NULL;
-    }
-    int latest_index = (buffer_head + buffer_count - 1) % MAX_FRAMES;
-    pthread_mutex_unlock(&frame_mutex);
-    return &frame_buffer[latest_index];
-}
-
 int main(int argc, char* argv[])
 {
-    int err;
+    int err = 0;
     int opt;
-    camera_unit_t unit = CAMERA_UNIT_NONE;
-    camera_handle_t handle = CAMERA_HANDLE_INVALID;
-    camera_frametype_t frametype = CAMERA_FRAMETYPE_UNSPECIFIED;
-
-    // Read command line options
-    while ((opt = getopt(argc, argv, "u:")) != -1 || (optind < argc)) {
+    camera_unit_t units[MAX_PIPELINES];
+    ThreadSchedConfig sched[MAX_PIPELINES][PIPELINE_THREAD_COUNT];
+    int numUnits = 0;
+    const char* recorderPath = NULL;
+    size_t recorderMegabytes = DEFAULT_RECORDER_MB;
+    FlightRecorderMode recorderMode = FLIGHT_RECORDER_RAW;
+    int extractSeconds = -1;
+    const char* extractDir = ".";
+    const char* capturePath = NULL;
+    const char* replayPath = NULL;
+    const char* watchName = NULL;
+    unsigned memoryFlags = 0;
+    StageRate rates[PIPELINE_STAGE_COUNT];
+    AdaptiveRateConfig adaptive = { 0 };
+    BurstConfig burst = { .pin = -1 };
+    HistogramConfig histogram = { .workers = 0, .step = 1 };
+    uint32_t statsStep = 1;
+    bool bursting = false;
+    char recorderStorage[MAX_PIPELINES][256];
+    char captureStorage[MAX_PIPELINES][256];
+
+    for (int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        stage_rate_init(&rates[stage]);
+    }
+
+    // Read command line options. Options that configure a unit (-a, -s) apply
+    // to the unit given by the preceding -u.
+    while ((opt = getopt(argc, argv, "u:a:s:R:A:g:T:S:r:m:jx:o:c:p:w:H")) != -1 || (optind < argc)) {
         switch (opt) {
         case 'u':
-            unit = (camera_unit_t)strtol(optarg, NULL, 10);
+            if (numUnits == MAX_PIPELINES) {
+                printf("Ignoring camera unit %s: at most %d units are supported\n", optarg, MAX_PIPELINES);
+                break;
+            }
+            units[numUnits] = (camera_unit_t)strtol(optarg, NULL, 10);
+            for (int role = 0; role < PIPELINE_THREAD_COUNT; role++) {
+                thread_sched_default(&sched[numUnits][role]);
+            }
+            numUnits++;
+            break;
+        case 'a':
+            if (numUnits == 0) {
+                printf("Ignoring -a %s: it must follow the -u option of its unit\n", optarg);
+                break;
+            }
+            for (int role = 0; role < PIPELINE_THREAD_COUNT; role++) {
+                sched[numUnits - 1][role].cpu_mask = strtoull(optarg, NULL, 0);
+            }
+            break;
+        case 's':
+            if ((numUnits == 0) || (parseSchedOption(optarg, sched[numUnits - 1]) != 0)) {
+                printf("Ignoring -s %s: expected <thread>=<policy>:<priority>[:<cpu_mask>] after -u\n", optarg);
+            }
+            break;
+        case 'R':
+            if (parseRateOption(optarg, rates) != 0) {
+                printf("Ignoring -R %s: expected <stage>=<n> or <stage>=<hz>hz\n", optarg);
+            }
+            break;
+        case 'A':
+            if (adaptive_rate_parse(optarg, &adaptive) != 0) {
+                printf("Ignoring -A %s: expected <low_fps>[:<threshold>[:<quiet_s>]]\n", optarg);
+                adaptive.low_fps = 0.0;
+            }
+            break;
+        case 'g':
+            if (burst_trigger_parse(optarg, &burst) != 0) {
+                printf("Ignoring -g %s: expected <pin>[:<rising|falling|both>[:<seconds>]]\n", optarg);
+                burst.pin = -1;
+            }
+            break;
+        case 'T':
+            if (histogram_parse(optarg, &histogram) != 0) {
+                printf("Ignoring -T %s: expected <threads>[:<step>] with 0 to %d threads\n", optarg,
+                       HISTOGRAM_MAX_WORKERS);
+                histogram.workers = 0;
+            }
+            break;
+        case 'S':
+            statsStep = (uint32_t)strtoul(optarg, NULL, 10);
+            if (statsStep == 0) {
+                printf("Ignoring -S %s: expected a step of at least 1\n", optarg);
+                statsStep = 1;
+            }
+            break;
+        case 'r':
+            recorderPath = optarg;
+            break;
+        case 'm':
+            recorderMegabytes = (size_t)strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            recorderMode = FLIGHT_RECORDER_JPEG;
+            break;
+        case 'x':
+            extractSeconds = (int)strtol(optarg, NULL, 10);
+            break;
+        case 'o':
+            extractDir = optarg;
+            break;
+        case 'c':
+            capturePath = optarg;
+            break;
+        case 'p':
+            replayPath = optarg;
+            break;
+        case 'w':
+            watchName = optarg;
+            break;
+        case 'H':
+            memoryFlags = FRAME_MEMORY_LARGE_PAGES | FRAME_MEMORY_LOCKED;
             break;
         default:
             printf("Ignoring unrecognized option: %s\n", optarg);
@@ -173,69 +279,213 @@ int main(int argc, char* argv[])
         }
     }
 
+    // Extract the last seconds of a flight recording instead of capturing
+    if (extractSeconds >= 0) {
+        if (recorderPath == NULL) {
+            printf("Please provide the flight recorder file with -r option\n");
+            exit(EXIT_FAILURE);
+        }
+        if (flight_recorder_open_readonly(&extract_recorder, recorderPath) != 0) {
+            exit(EXIT_FAILURE);
+        }
+        int count = flight_recorder_extract(&extract_recorder, (unsigned)extractSeconds, extractDir);
+        flight_recorder_close(&extract_recorder);
+        if (count < 0) {
+            exit(EXIT_FAILURE);
+        }
+        printf("Extracted %d frames to %s\n", count, extractDir);
+        exit(EXIT_SUCCESS);
+    }
+
+    // Follow the frames another instance publishes instead of capturing
+    if (watchName) {
+        (void)watchMetadata(watchName);
+        exit(EXIT_FAILURE);
+    }
+
+    // Replaying a capture file runs a single pipeline without a camera
+    if (replayPath) {
+        if (numUnits == 0) {
+            for (int role = 0; role < PIPELINE_THREAD_COUNT; role++) {
+                thread_sched_default(&sched[0][role]);
+            }
+        }
+        units[0] = CAMERA_UNIT_NONE;
+        numUnits = 1;
+    }
+
     // If no camera unit has been specified, list the options and exit
-    if ((unit == CAMERA_UNIT_NONE) || (unit >= CAMERA_UNIT_NUM_UNITS)) {
+    bool validUnits = (numUnits > 0);
+    for (int i = 0; (i < numUnits) && (replayPath == NULL); i++) {
+        if ((units[i] == CAMERA_UNIT_NONE) || (units[i] >= CAMERA_UNIT_NUM_UNITS)) {
+            validUnits = false;
+        }
+    }
+    if (!validUnits) {
         listAvailableCameras();
         printf("Please provide camera unit with -u option\n");
         exit(EXIT_SUCCESS);
     }
 
-    // Open a read-only handle for the specified camera unit.
-    // CAMERA_MODE_RO doesn't give us access to change camera configuration
-    // and we can't modify the memory in a provided buffer.
-    err = camera_open(unit, CAMERA_MODE_RO, &handle);
-    if ((err != CAMERA_EOK) || (handle == CAMERA_HANDLE_INVALID)) {
-        printf("Failed to open CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
-        exit(EXIT_FAILURE);
+    // A GPIO edge switches the ring and its consumers to every frame for a while
+    if ((burst.pin >= 0) && (replayPath == NULL)) {
+        if (burst_trigger_start(&burst_trigger, &burst) == 0) {
+            bursting = true;
+            rates[PIPELINE_STAGE_RING].full_rate = &burst_trigger.active;
+            rates[PIPELINE_STAGE_STREAM].full_rate = &burst_trigger.active;
+            rates[PIPELINE_STAGE_RECORDER].full_rate = &burst_trigger.active;
+            rates[PIPELINE_STAGE_CAPTURE].full_rate = &burst_trigger.active;
+        } else {
+            printf("Continuing without burst capture\n");
+        }
     }
 
-    // Create shared memory for metadata
-    metadata_fd = shm_open("/camera_metadata", O_CREAT | O_RDWR, 0666);
-    if (metadata_fd == -1) {
-        printf("Failed to create metadata shm\n");
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+    // Set up one pipeline per unit. A single unit keeps the original shared
+    // memory names; with several units every name is prefixed by its unit.
+    for (int i = 0; i < numUnits; i++) {
+        CameraPipelineConfig config;
+        memset(&config, 0, sizeof(config));
+        config.unit = units[i];
+        if (numUnits == 1) {
+            snprintf(config.shm_prefix, sizeof(config.shm_prefix), "/camera");
+        } else {
+            snprintf(config.shm_prefix, sizeof(config.shm_prefix), "/camera%d", (int)units[i]);
+        }
+        config.host = (replayPath == NULL) ? STREAM_HOST : NULL;
+        config.port = (uint16_t)(STREAM_BASE_PORT + i);
+        memcpy(config.sched, sched[i], sizeof(config.sched));
+        config.memory_flags = memoryFlags;
+        memcpy(config.rates, rates, sizeof(config.rates));
+        config.adaptive = adaptive;
+        config.histogram = histogram;
+        config.stats_step = statsStep;
+        config.recorder_size = recorderMegabytes * 1024 * 1024;
+        config.recorder_mode = recorderMode;
+        if (recorderPath) {
+            config.recorder_path = (numUnits == 1) ? recorderPath
+                                 : unitPath(recorderPath, units[i], recorderStorage[i], sizeof(recorderStorage[i]));
+        }
+        if (capturePath) {
+            config.capture_path = (numUnits == 1) ? capturePath
+                                : unitPath(capturePath, units[i], captureStorage[i], sizeof(captureStorage[i]));
+        }
+
+        // Open the camera first so the pipeline can size its buffers for its resolution
+        camera_handle_t handle = CAMERA_HANDLE_INVALID;
+        if ((replayPath == NULL) && (openCamera(units[i], (adaptive.low_fps > 0.0) ? CAMERA_MODE_RW : CAMERA_MODE_RO, &handle,
+                                                 &config.frame_width, &config.frame_height) != 0)) {
+            if (handle != CAMERA_HANDLE_INVALID) {
+                (void)camera_close(handle);
+            }
+            err = -1;
+            break;
+        }
+        if (camera_pipeline_start(&pipelines[i], &config) != 0) {
+            if (handle != CAMERA_HANDLE_INVALID) {
+                (void)camera_close(handle);
+            }
+            err = -1;
+            break;
+        }
+        pipelines[i].handle = handle;
+        num_pipelines++;
+
+        // Watch the scene from the first frame on so the rate can drop when nothing happens
+        if ((handle != CAMERA_HANDLE_INVALID) && (adaptive.low_fps > 0.0)) {
+            pipelines[i].adapting = (adaptive_rate_start(&pipelines[i].adaptive, &adaptive, handle,
+                                                         processCameraData, &pipelines[i]) == 0);
+        }
     }
-    if (ftruncate(metadata_fd, sizeof(Metadata)) == -1) {
-        printf("Failed to truncate metadata\n");
-        close(metadata_fd);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+
+    // SIGUSR1 is the external trigger that restores the full frame rate
+    if (adaptive.low_fps > 0.0) {
+        (void)signal(SIGUSR1, onRateTrigger);
     }
-    metadata_mapped = mmap(NULL, sizeof(Metadata), PROT_READ | PROT_WRITE, MAP_SHARED, metadata_fd, 0);
-    if (metadata_mapped == MAP_FAILED) {
-        printf("Failed to mmap metadata\n");
-        close(metadata_fd);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+    printf("\n");
+
+    if ((err == 0) && replayPath) {
+        err = replayCapture(&pipelines[0], replayPath);
+    } else if (err == 0) {
+        // Start the camera streaming: callbacks will start being received
+        int started = 0;
+        for (; started < num_pipelines; started++) {
+            CameraPipeline* pipeline = &pipelines[started];
+            err = camera_start_viewfinder(pipeline->handle, processCameraData, NULL, pipeline);
+            if (err != CAMERA_EOK) {
+                printf("Failed to start CAMERA_UNIT_%d: err = %d\n", (int)pipeline->config.unit, err);
+                break;
+            }
+        }
+
+        if (err == CAMERA_EOK) {
+            blockOnKeyPress();
+        }
+
+        // The rate controllers may restart a viewfinder, so stop them first
+        for (int i = 0; i < num_pipelines; i++) {
+            if (pipelines[i].adapting) {
+                adaptive_rate_stop(&pipelines[i].adaptive);
+                pipelines[i].adapting = false;
+            }
+        }
+
+        // Stop the camera streaming: no more callbacks will be received
+        for (int i = 0; i < started; i++) {
+            CameraPipeline* pipeline = &pipelines[i];
+            int stopErr = camera_stop_viewfinder(pipeline->handle);
+            if (stopErr != CAMERA_EOK) {
+                printf("\r\nFailed to stop CAMERA_UNIT_%d: err = %d\n", (int)pipeline->config.unit, stopErr);
+                err = stopErr;
+            }
+        }
+        printf("\r\n");
     }
-    close(metadata_fd);
-    metadata_fd = -1;
 
-    // Connect to host for JPEG streaming
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        printf("Failed to create socket\n");
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+    // Close the camera handles, then tear down each pipeline
+    for (int i = 0; i < num_pipelines; i++) {
+        CameraPipeline* pipeline = &pipelines[i];
+        if (pipeline->adapting) {
+            adaptive_rate_stop(&pipeline->adaptive);
+            pipeline->adapting = false;
+        }
+        if (pipeline->handle != CAMERA_HANDLE_INVALID) {
+            int closeErr = camera_close(pipeline->handle);
+            if (closeErr != CAMERA_EOK) {
+                printf("Failed to close CAMERA_UNIT_%d: err = %d\n", (int)pipeline->config.unit, closeErr);
+                err = closeErr;
+            }
+        }
+        camera_pipeline_stop(pipeline);
     }
-    struct sockaddr_in server;
-    server.sin_family = AF_INET;
-    server.sin_addr.s_addr = inet_addr("192.168.1.100"); // Change to host IP
-    server.sin_port = htons(5001);
-    if (connect(sock, (struct sockaddr*)&server, sizeof(server)) < 0) {
-        printf("Failed to connect to host\n");
-        close(sock);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+    if (bursting) {
+        burst_trigger_stop(&burst_trigger);
+    }
+
+    exit((err == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+static int openCamera(camera_unit_t unit, camera_mode_t mode, camera_handle_t* handle, uint32_t* width,
+                      uint32_t* height)
+{
+    camera_frametype_t frametype = CAMERA_FRAMETYPE_UNSPECIFIED;
+    int err;
+
+    // Open a handle for the specified camera unit. CAMERA_MODE_RO doesn't
+    // give us access to change camera configuration and we can't modify the
+    // memory in a provided buffer; changing the frame rate needs CAMERA_MODE_RW.
+    err = camera_open(unit, mode, handle);
+    if ((err != CAMERA_EOK) || (*handle == CAMERA_HANDLE_INVALID)) {
+        printf("Failed to open CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
+        *handle = CAMERA_HANDLE_INVALID;
+        return -1;
     }
 
     // Make sure that this camera defaults to a supported frametype
-    err = camera_get_vf_property(handle, CAMERA_IMGPROP_FORMAT, &frametype);
+    err = camera_get_vf_property(*handle, CAMERA_IMGPROP_FORMAT, &frametype,
+                                 CAMERA_IMGPROP_WIDTH, width, CAMERA_IMGPROP_HEIGHT, height);
     if (err != CAMERA_EOK) {
         printf("Failed to get frametype for CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+        return -1;
     }
     bool unsupportedFrametype = true;
     for (uint i = 0; i < NUM_SUPPORTED_FRAMETYPES; i++) {
@@ -246,61 +496,52 @@ int main(int argc, char* argv[])
     }
     if (unsupportedFrametype) {
         printf("Camera frametype %d is not supported\n", (int)frametype);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    printf("\n");
-
-    // Start the camera streaming: callbacks will start being received
-    err = camera_start_viewfinder(handle, processCameraData, NULL, NULL);
-    if (err != CAMERA_EOK) {
-        printf("Failed to start CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
-    }
-
-    blockOnKeyPress();
 
-    // Stop the camera streaming: no more callbacks will be received
-    err = camera_stop_viewfinder(handle);
-    printf("\r\n");
-    if (err != CAMERA_EOK) {
-        printf("Failed to stop CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
-        (void)camera_close(handle);
-        exit(EXIT_FAILURE);
-    }
+    return 0;
+}
 
-    // Close the camera handle
-    err = camera_close(handle);
-    if (err != CAMERA_EOK) {
-        printf("Failed to close CAMERA_UNIT_%d: err = %d\n", (int)unit, err);
-        exit(EXIT_FAILURE);
-    }
+static void onRateTrigger(int signo)
+{
+    (void)signo;
+    adaptive_rate_trigger_all();
+}
 
-    // Free frame buffer
-    for (int i = 0; i < buffer_count; i++) {
-        int idx = (buffer_head + i) % MAX_FRAMES;
-        munmap(frame_buffer[idx].mapped_data, frame_buffer[idx].data_size);
-        shm_unlink(frame_buffer[idx].shm_name);
-        free(frame_buffer[idx].shm_name);
+static int parseSchedOption(const char* option, ThreadSchedConfig* sched)
+{
+    const char* equals = strchr(option, '=');
+    if (equals == NULL) {
+        return -1;
+    }
+    for (int role = 0; role < PIPELINE_THREAD_COUNT; role++) {
+        const char* name = camera_pipeline_thread_name((PipelineThread)role);
+        if ((strlen(name) == (size_t)(equals - option)) && (strncmp(name, option, strlen(name)) == 0)) {
+            return thread_sched_parse(equals + 1, &sched[role]);
+        }
     }
+    return -1;
+}
 
-    // Free shared memory
-    if (metadata_mapped) {
-        munmap(metadata_mapped, sizeof(Metadata));
-        shm_unlink("/camera_metadata");
-    }
-    if (latest_mapped) {
-        munmap(latest_mapped, latest_size);
-        shm_unlink(latest_shm_name);
-        free(latest_shm_name);
-    }
-    shm_unlink("/camera_latest_name");
-    if (sock != -1) {
-        close(sock);
+static int parseRateOption(const char* option, StageRate* rates)
+{
+    const char* equals = strchr(option, '=');
+    if (equals == NULL) {
+        return -1;
+    }
+    for (int stage = 0; stage < PIPELINE_STAGE_COUNT; stage++) {
+        const char* name = camera_pipeline_stage_name((PipelineStage)stage);
+        if ((strlen(name) == (size_t)(equals - option)) && (strncmp(name, option, strlen(name)) == 0)) {
+            return stage_rate_parse(equals + 1, &rates[stage]);
+        }
     }
+    return -1;
+}
 
-    exit(EXIT_SUCCESS);
+static const char* unitPath(const char* path, camera_unit_t unit, char* storage, size_t size)
+{
+    snprintf(storage, size, "%s.%d", path, (int)unit);
+    return storage;
 }
 
 static void listAvailableCameras(void)
@@ -348,243 +589,64 @@ static void processCameraData(camera_handle_t handle, camera_buffer_t* buffer, v
 {
     clock_t begin;
     clock_t end;
-    double channelAverage[NUM_CHANNELS];
+    FrameStats stats;
 
-    // No need for handle or argument data
+    // The pipeline of the unit delivering the frame is passed as argument
+    CameraPipeline* pipeline = (CameraPipeline*)arg;
     (void)handle;
-    (void)arg;
 
-    // Store frame in buffer
-    pthread_mutex_lock(&frame_mutex);
+    // The callback thread belongs to libcamapi; schedule it on its first frame
+    camera_pipeline_schedule_callback(pipeline);
+
+    // Let the frame rate follow scene activity
+    if (pipeline->adapting) {
+        adaptive_rate_observe(&pipeline->adaptive, buffer);
+    }
+
+    // Each stage runs at its own rate; a stage that isn't due costs a counter check
+    int64_t timestamp = buffer->frametimestamp;
     size_t size = get_frame_size(buffer);
-    if (buffer_count == MAX_FRAMES) {
-        // Free oldest frame
-        munmap(frame_buffer[buffer_head].mapped_data, frame_buffer[buffer_head].data_size);
-        shm_unlink(frame_buffer[buffer_head].shm_name);
-        free(frame_buffer[buffer_head].shm_name);
-        buffer_head = (buffer_head + 1) % MAX_FRAMES;
-        buffer_count--;
-    }
-    int index = (buffer_head + buffer_count) % MAX_FRAMES;
-    char shm_name[256];
-    snprintf(shm_name, sizeof(shm_name), "/camera_frame_%d", index);
-    int fd = shm_open(shm_name, O_CREAT | O_RDWR, 0666);
-    if (fd != -1) {
-        if (ftruncate(fd, size) != -1) {
-            uint8_t* mapped_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-            if (mapped_data != MAP_FAILED) {
-                memcpy(mapped_data, buffer->framebuf, size);
-                frame_buffer[index].frametype = buffer->frametype;
-                frame_buffer[index].framedesc = buffer->framedesc;
-                frame_buffer[index].shm_name = strdup(shm_name);
-                frame_buffer[index].mapped_data = mapped_data;
-                frame_buffer[index].data_size = size;
-                buffer_count++;
-            }
-            close(fd);
-        } else {
-            close(fd);
-        }
+    uint32_t width = 0, height = 0, stride = 0;
+    frame_get_dimensions(buffer->frametype, &buffer->framedesc, &width, &height, &stride);
+
+    // Update latest shared memory first: it is the only part of the hot path
+    // that may still have to allocate, and only on the very first frame
+    if (camera_pipeline_stage_due(pipeline, PIPELINE_STAGE_LATEST, timestamp)) {
+        camera_pipeline_publish_latest(pipeline, buffer, size);
     }
-    pthread_mutex_unlock(&frame_mutex);
-
-    // Update latest shared memory
-    if (latest_mapped) {
-        munmap(latest_mapped, latest_size);
-        shm_unlink(latest_shm_name);
-        free(latest_shm_name);
-    }
-    latest_shm_name = strdup("/camera_latest");
-    int latest_fd = shm_open(latest_shm_name, O_CREAT | O_RDWR, 0666);
-    if (latest_fd != -1) {
-        size_t size = get_frame_size(buffer);
-        if (ftruncate(latest_fd, size) != -1) {
-            latest_mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, latest_fd, 0);
-            if (latest_mapped != MAP_FAILED) {
-                memcpy(latest_mapped, buffer->framebuf, size);
-                latest_size = size;
-            }
-            close(latest_fd);
-        } else {
-            close(latest_fd);
-        }
+
+    // Store frame in the ring; busy slots are skipped rather than waited on
+    if (camera_pipeline_stage_due(pipeline, PIPELINE_STAGE_RING, timestamp)) {
+        (void)frame_ring_push(&pipeline->ring, buffer, size);
     }
 
-    // Update metadata
-    uint32_t width = 0, height = 0;
-    switch (buffer->frametype) {
-    case CAMERA_FRAMETYPE_RGB8888:
-        width = buffer->framedesc.rgb8888.width;
-        height = buffer->framedesc.rgb8888.height;
-        break;
-    case CAMERA_FRAMETYPE_BGR8888:
-        width = buffer->framedesc.bgr8888.width;
-        height = buffer->framedesc.bgr8888.height;
-        break;
-    case CAMERA_FRAMETYPE_YCBYCR:
-        width = buffer->framedesc.ycbycr.width;
-        height = buffer->framedesc.ycbycr.height;
-        break;
-    case CAMERA_FRAMETYPE_CBYCRY:
-        width = buffer->framedesc.cbycry.width;
-        height = buffer->framedesc.cbycry.height;
-        break;
-    default:
-        width = 0;
-        height = 0;
-        break;
-    }
-    metadata_mapped->frametype = buffer->frametype;
-    metadata_mapped->width = width;
-    metadata_mapped->height = height;
-    metadata_mapped->size = size;
-
-    // Update latest name
-    int name_fd = shm_open("/camera_latest_name", O_CREAT | O_RDWR, 0666);
-    if (name_fd != -1) {
-        if (ftruncate(name_fd, 256) != -1) {
-            char* name_mapped = mmap(NULL, 256, PROT_READ | PROT_WRITE, MAP_SHARED, name_fd, 0);
-            if (name_mapped != MAP_FAILED) {
-                strncpy(name_mapped, "/camera_latest", 256);
-                munmap(name_mapped, 256);
-            }
-        }
-        close(name_fd);
+    // Segment the plant on the raw frame so readers get its shape along with the frame
+    if (camera_pipeline_stage_due(pipeline, PIPELINE_STAGE_VISION, timestamp)) {
+        (void)plant_vision_measure(buffer, &pipeline->vision);
+    }
+
+    // Publish the frame description and wake readers blocked on the metadata page
+    if (camera_pipeline_stage_due(pipeline, PIPELINE_STAGE_METADATA, timestamp)) {
+        camera_metadata_publish(pipeline->metadata, buffer->frametype, width, height, size, timestamp,
+                                &pipeline->vision);
+    }
+
+    if (!camera_pipeline_stage_due(pipeline, PIPELINE_STAGE_STATS, timestamp)) {
+        return;
     }
 
     // Camera data is buffer->framebuf and described by buffer->framedesc.
-    // As an example, let's compute channel averages by iterating over the
-    // bytes in each line and determining which channel the byte belongs to.
+    // As an example, let's compute channel averages (R, G, B or Y, Cb, Cr),
+    // exactly or from every n-th row and column.
 
-    // Get dimensions
-    uint32_t width = 0, height = 0, stride = 0;
-    switch (buffer->frametype) {
-    case CAMERA_FRAMETYPE_RGB8888:
-        width = buffer->framedesc.rgb8888.width;
-        height = buffer->framedesc.rgb8888.height;
-        stride = buffer->framedesc.rgb8888.stride;
-        break;
-    case CAMERA_FRAMETYPE_BGR8888:
-        width = buffer->framedesc.bgr8888.width;
-        height = buffer->framedesc.bgr8888.height;
-        stride = buffer->framedesc.bgr8888.stride;
-        break;
-    case CAMERA_FRAMETYPE_YCBYCR:
-        width = buffer->framedesc.ycbycr.width;
-        height = buffer->framedesc.ycbycr.height;
-        stride = buffer->framedesc.ycbycr.stride;
-        break;
-    case CAMERA_FRAMETYPE_CBYCRY:
-        width = buffer->framedesc.cbycry.width;
-        height = buffer->framedesc.cbycry.height;
-        stride = buffer->framedesc.cbycry.stride;
-        break;
-    default:
-        width = 0;
-        height = 0;
-        stride = 0;
-        break;
-    }
-
-    // Compress to JPEG and send if RGB8888
-    if (buffer->frametype == CAMERA_FRAMETYPE_RGB8888 && width > 0 && height > 0) {
-        uint8_t* rgb_data = malloc(width * height * 3);
-        if (rgb_data) {
-            for (uint32_t y = 0; y < height; y++) {
-                for (uint32_t x = 0; x < width; x++) {
-                    rgb_data[(y * width + x) * 3] = buffer->framebuf[y * stride + x * 4];
-                    rgb_data[(y * width + x) * 3 + 1] = buffer->framebuf[y * stride + x * 4 + 1];
-                    rgb_data[(y * width + x) * 3 + 2] = buffer->framebuf[y * stride + x * 4 + 2];
-                }
-            }
-            uint8_t* jpeg_data = NULL;
-            unsigned long jpeg_size = 0;
-            compress_to_jpeg(rgb_data, width, height, &jpeg_data, &jpeg_size);
-            free(rgb_data);
-            if (jpeg_data) {
-                send(sock, &jpeg_size, sizeof(unsigned long), 0);
-                send(sock, jpeg_data, jpeg_size, 0);
-                free(jpeg_data);
-            }
-        }
+    // The frametype only changes with the stream, so the kernel is picked once
+    if ((pipeline->stats_kernel == NULL) || (pipeline->stats_frametype != buffer->frametype)) {
+        pipeline->stats_kernel = frame_stats_kernel(buffer->frametype);
+        pipeline->stats_frametype = buffer->frametype;
     }
 
     begin = clock();
-    memset(channelAverage, 0x0, sizeof(channelAverage));
-    switch (buffer->frametype) {
-    case CAMERA_FRAMETYPE_RGB8888:
-    {
-        // Channel averages ordering: R, G, B
-        for (uint y = 0; y < height; y++) {
-            uint8_t* linePointer = buffer->framebuf + y * stride;
-            for (uint i = 0; i < 4 * width; i++) {
-                uint chan = i % 4;
-                if (chan == 3) {
-                    continue;
-                }
-                channelAverage[chan] += (double)*(linePointer + i);
-            }
-        }
-        for (uint chan = 0; chan < NUM_CHANNELS; chan++) {
-            channelAverage[chan] /= (double)(width * height);
-        }
-        break;
-    }
-    case CAMERA_FRAMETYPE_BGR8888:
-    {
-        // Channel averages ordering: R, G, B
-        for (uint y = 0; y < height; y++) {
-            uint8_t* linePointer = buffer->framebuf + y * stride;
-            for (uint i = 0; i < 4 * width; i++) {
-                if (i % 4 == 3) {
-                    continue;
-                }
-                uint chan = (4 * width - i + 3) % 4 - 1;
-                channelAverage[chan] += (double)*(linePointer + i);
-            }
-        }
-        for (uint chan = 0; chan < NUM_CHANNELS; chan++) {
-            channelAverage[chan] /= (double)(width * height);
-        }
-        break;
-    }
-    case CAMERA_FRAMETYPE_YCBYCR:
-    {
-        // Channel averages ordering: Y, Cb, Cr
-        for (uint y = 0; y < height; y++) {
-            uint8_t* linePointer = buffer->framebuf + y * stride;
-            for (uint i = 0; i < 2 * width; i++) {
-                uint chan = i % 2;
-                if (chan == 1) {
-                    chan = (i - 1) % 4 / 2 + 1;
-                }
-                channelAverage[chan] += (double)*(linePointer + i);
-            }
-        }
-        channelAverage[0] /= (double)(width * height);
-        channelAverage[1] /= (double)(width / 2 * height);
-        channelAverage[2] /= (double)(width / 2 * height);
-        break;
-    }
-    case CAMERA_FRAMETYPE_CBYCRY:
-    {
-        // Channel averages ordering: Y, Cb, Cr
-        for (uint y = 0; y < height; y++) {
-            uint8_t* linePointer = buffer->framebuf + y * stride;
-            for (uint i = 0; i < 2 * width; i++) {
-                uint chan = (i + 1) % 2;
-                if (chan == 1) {
-                    chan = ((i + 1) % 4 + 1) / 2;
-                }
-                channelAverage[chan] += (double)*(linePointer + i);
-            }
-        }
-        channelAverage[0] /= (double)(width * height);
-        channelAverage[1] /= (double)(width / 2 * height);
-        channelAverage[2] /= (double)(width / 2 * height);
-        break;
-    }
-    default:
+    if (frame_stats_compute(pipeline->stats_kernel, buffer, pipeline->config.stats_step, &stats) != 0) {
         printf("\r");
         printf("Frametype %d is not suppported!", (int)buffer->frametype);
         printf(" (press any key to stop example)");
@@ -595,7 +657,12 @@ static void processCameraData(camera_handle_t handle, camera_buffer_t* buffer, v
 
     printf("\r");
     printf("Channel averages: ");
-    printf("%.3f, %.3f, %.3f", channelAverage[0], channelAverage[1], channelAverage[2]);
+    if (stats.step == 1) {
+        printf("%.3f, %.3f, %.3f", stats.mean[0], stats.mean[1], stats.mean[2]);
+    } else {
+        printf("%.3f +-%.3f, %.3f +-%.3f, %.3f +-%.3f", stats.mean[0], stats.std_error[0], stats.mean[1],
+               stats.std_error[1], stats.mean[2], stats.std_error[2]);
+    }
     printf(" took %.3f ms", (double)(end - begin) / CLOCKS_PER_SEC * 1000);
     printf(" (press any key to stop example)     ");
     fflush(stdout);
@@ -613,9 +680,101 @@ static void blockOnKeyPress(void)
     newterm = oldterm;
     newterm.c_lflag &= ~(ECHO | ICANON);
     (void)tcsetattr(STDIN_FILENO, TCSANOW, &newterm);
-    // Blocking call: wait for 1 byte of data to become available
-    (void)read(STDIN_FILENO, &key, 1);
+    // Blocking call: wait for 1 byte of data to become available; signals
+    // such as the frame rate trigger must not end the example
+    while ((read(STDIN_FILENO, &key, 1) == -1) && (errno == EINTR)) {
+    }
     (void)tcsetattr(STDIN_FILENO, TCSANOW, &oldterm);
 
     return;
 }
+
+static int watchMetadata(const char* name)
+{
+    Metadata* metadata = NULL;
+    MetadataSnapshot frame;
+
+    for (;;) {
+        if (metadata == NULL) {
+            // The writer may not have created the page yet, or be restarting
+            metadata = camera_metadata_open(name);
+            if (metadata == NULL) {
+                sleep(1);
+                continue;
+            }
+            memset(&frame, 0, sizeof(frame));
+            printf("Watching %s\n", name);
+        }
+
+        int err = camera_metadata_wait(metadata, frame.sequence, 1000, &frame);
+        if (err == 0) {
+            printf("Frame %llu: %ux%u, %zu bytes, timestamp %lld, plant coverage %.3f\n",
+                   (unsigned long long)frame.sequence, frame.width, frame.height, frame.size,
+                   (long long)frame.timestamp, frame.vision.coverage);
+        } else if (err == ESTALE) {
+            printf("Writer of %s stopped, waiting for it to come back\n", name);
+            camera_metadata_close(metadata);
+            metadata = NULL;
+        } else if (err != ETIMEDOUT) {
+            printf("Failed to wait for frames on %s: %s\n", name, strerror(err));
+            camera_metadata_close(metadata);
+            return -1;
+        }
+    }
+}
+
+static int replayCapture(CameraPipeline* pipeline, const char* path)
+{
+    FrameCaptureReader reader;
+    FrameCaptureRecord record = { 0 };
+    camera_buffer_t buffer;
+    uint8_t* data = NULL;
+    size_t capacity = 0;
+    uint64_t frames = 0;
+    struct timespec begin;
+    struct timespec end;
+    int err;
+
+    if (frame_capture_open(&reader, path) != 0) {
+        return -1;
+    }
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &begin);
+    while ((err = frame_capture_read(&reader, &record, data, capacity)) != 0) {
+        if (err == FRAME_CAPTURE_TOO_SMALL) {
+            // Grow the frame buffer to fit the record
+            uint8_t* grown = realloc(data, record.raw_size);
+            if (grown == NULL) {
+                printf("Failed to allocate %u bytes for frame %llu\n", record.raw_size, (unsigned long long)frames);
+                err = -1;
+                break;
+            }
+            data = grown;
+            capacity = record.raw_size;
+            continue;
+        }
+        if (err < 0) {
+            printf("Failed to read frame %llu from %s\n", (unsigned long long)frames, path);
+            break;
+        }
+
+        // Present the frame exactly as the camera callback would have seen it
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.frametype = (camera_frametype_t)record.frametype;
+        buffer.framebuf = data;
+        buffer.framesize = record.raw_size;
+        buffer.frametimestamp = record.timestamp;
+        frame_set_dimensions(buffer.frametype, &buffer.framedesc, record.width, record.height, record.stride);
+        processCameraData(CAMERA_HANDLE_INVALID, &buffer, pipeline);
+        frames++;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (double)(end.tv_sec - begin.tv_sec) + (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("\r\nReplayed %llu frames in %.3f s (%.1f fps)\n", (unsigned long long)frames, seconds,
+           (seconds > 0.0) ? (double)frames / seconds : 0.0);
+
+    free(data);
+    frame_capture_close(&reader);
+    return (err < 0) ? -1 : 0;
+}
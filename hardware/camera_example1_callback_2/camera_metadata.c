@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "camera_metadata.h"
+
+/**
+ * @brief Locks the page mutex, recovering it if a previous owner died while holding it
+ */
+static int lockMetadata(Metadata* metadata)
+{
+    int err = pthread_mutex_lock(&metadata->lock);
+    if (err == EOWNERDEAD) {
+        // The fields are always written as a whole under the lock, so the
+        // page is still consistent even though its owner went away.
+        (void)pthread_mutex_consistent(&metadata->lock);
+        err = 0;
+    }
+    return err;
+}
+
+/**
+ * @brief Marks a page as abandoned by its writer and wakes every reader waiting on it
+ */
+static void retireMetadata(Metadata* metadata)
+{
+    if (lockMetadata(metadata) != 0) {
+        return;
+    }
+    __atomic_store_n(&metadata->magic, 0, __ATOMIC_RELEASE);
+    (void)pthread_cond_broadcast(&metadata->frame_ready);
+    (void)pthread_mutex_unlock(&metadata->lock);
+}
+
+/**
+ * @brief Checks whether the writer of a page retired it or is no longer running
+ */
+static bool writerGone(const Metadata* metadata)
+{
+    if (__atomic_load_n(&metadata->magic, __ATOMIC_ACQUIRE) != CAMERA_METADATA_MAGIC) {
+        return true;
+    }
+    return (kill((pid_t)metadata->writer_pid, 0) == -1) && (errno == ESRCH);
+}
+
+static void copySnapshot(const Metadata* metadata, MetadataSnapshot* snapshot)
+{
+    snapshot->frametype = metadata->frametype;
+    snapshot->width = metadata->width;
+    snapshot->height = metadata->height;
+    snapshot->size = metadata->size;
+    snapshot->sequence = metadata->sequence;
+    snapshot->timestamp = metadata->timestamp;
+    snapshot->vision = metadata->vision;
+}
+
+Metadata* camera_metadata_create(const char* name)
+{
+    pthread_mutexattr_t mutexAttr;
+    pthread_condattr_t condAttr;
+    Metadata* metadata;
+
+    // Readers of a page left by an earlier writer may still have it mapped,
+    // and may be blocked on its condition variable, so it is never
+    // reinitialised. It is retired, which wakes them to reopen the name, and
+    // unlinked; they keep their mapping of it until they close it.
+    Metadata* previous = camera_metadata_open(name);
+    if (previous) {
+        retireMetadata(previous);
+        camera_metadata_close(previous);
+    }
+    (void)shm_unlink(name);
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+    if (fd == -1) {
+        printf("Failed to create metadata shm %s\n", name);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(Metadata)) == -1) {
+        printf("Failed to truncate metadata\n");
+        close(fd);
+        return NULL;
+    }
+    metadata = mmap(NULL, sizeof(Metadata), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metadata == MAP_FAILED) {
+        printf("Failed to mmap metadata\n");
+        return NULL;
+    }
+
+    // Readers check the magic before touching the synchronisation objects,
+    // so it stays cleared until they are initialised.
+    memset(metadata, 0, sizeof(Metadata));
+
+    (void)pthread_mutexattr_init(&mutexAttr);
+    (void)pthread_mutexattr_setpshared(&mutexAttr, PTHREAD_PROCESS_SHARED);
+    (void)pthread_mutexattr_setrobust(&mutexAttr, PTHREAD_MUTEX_ROBUST);
+    (void)pthread_mutex_init(&metadata->lock, &mutexAttr);
+    (void)pthread_mutexattr_destroy(&mutexAttr);
+
+    (void)pthread_condattr_init(&condAttr);
+    (void)pthread_condattr_setpshared(&condAttr, PTHREAD_PROCESS_SHARED);
+    (void)pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    (void)pthread_cond_init(&metadata->frame_ready, &condAttr);
+    (void)pthread_condattr_destroy(&condAttr);
+
+    metadata->writer_pid = (uint32_t)getpid();
+    __atomic_store_n(&metadata->magic, CAMERA_METADATA_MAGIC, __ATOMIC_RELEASE);
+
+    return metadata;
+}
+
+Metadata* camera_metadata_open(const char* name)
+{
+    Metadata* metadata;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+    metadata = mmap(NULL, sizeof(Metadata), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (metadata == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&metadata->magic, __ATOMIC_ACQUIRE) != CAMERA_METADATA_MAGIC) {
+        munmap(metadata, sizeof(Metadata));
+        return NULL;
+    }
+
+    return metadata;
+}
+
+void camera_metadata_close(Metadata* metadata)
+{
+    if (metadata) {
+        munmap(metadata, sizeof(Metadata));
+    }
+}
+
+void camera_metadata_destroy(Metadata* metadata, const char* name)
+{
+    if (metadata) {
+        retireMetadata(metadata);
+        camera_metadata_close(metadata);
+        (void)shm_unlink(name);
+    }
+}
+
+uint64_t camera_metadata_publish(Metadata* metadata, camera_frametype_t frametype,
+                                 uint32_t width, uint32_t height, size_t size, int64_t timestamp,
+                                 const PlantVisionMetrics* vision)
+{
+    uint64_t sequence;
+
+    (void)lockMetadata(metadata);
+    metadata->frametype = frametype;
+    metadata->width = width;
+    metadata->height = height;
+    metadata->size = size;
+    metadata->timestamp = timestamp;
+    if (vision) {
+        metadata->vision = *vision;
+    }
+    sequence = ++metadata->sequence;
+    (void)pthread_cond_broadcast(&metadata->frame_ready);
+    (void)pthread_mutex_unlock(&metadata->lock);
+
+    return sequence;
+}
+
+void camera_metadata_publish_histogram(Metadata* metadata, const FrameHistogram* histogram)
+{
+    (void)lockMetadata(metadata);
+    metadata->histogram = *histogram;
+    (void)pthread_mutex_unlock(&metadata->lock);
+}
+
+int camera_metadata_read_histogram(Metadata* metadata, FrameHistogram* histogram)
+{
+    int err = lockMetadata(metadata);
+    if (err != 0) {
+        return err;
+    }
+    *histogram = metadata->histogram;
+    (void)pthread_mutex_unlock(&metadata->lock);
+
+    return 0;
+}
+
+int camera_metadata_wait(Metadata* metadata, uint64_t last_sequence, int timeout_ms,
+                         MetadataSnapshot* snapshot)
+{
+    struct timespec deadline;
+    int err;
+
+    if (timeout_ms >= 0) {
+        (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    err = lockMetadata(metadata);
+    if (err != 0) {
+        return err;
+    }
+    for (;;) {
+        if (__atomic_load_n(&metadata->magic, __ATOMIC_ACQUIRE) != CAMERA_METADATA_MAGIC) {
+            err = ESTALE;
+            break;
+        }
+        if (metadata->sequence != last_sequence) {
+            break;
+        }
+        if (timeout_ms >= 0) {
+            err = pthread_cond_timedwait(&metadata->frame_ready, &metadata->lock, &deadline);
+        } else {
+            err = pthread_cond_wait(&metadata->frame_ready, &metadata->lock);
+        }
+        if (err == EOWNERDEAD) {
+            (void)pthread_mutex_consistent(&metadata->lock);
+            err = 0;
+        }
+        // A writer that died cannot retire its page, so check on it while no frames come
+        if ((err == ETIMEDOUT) && writerGone(metadata)) {
+            err = ESTALE;
+        }
+        if (err != 0) {
+            break;
+        }
+    }
+    if ((err == 0) && snapshot) {
+        copySnapshot(metadata, snapshot);
+    }
+    (void)pthread_mutex_unlock(&metadata->lock);
+
+    return err;
+}
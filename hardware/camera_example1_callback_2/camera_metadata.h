@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_METADATA_H
+#define CAMERA_METADATA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <camera/camera_api.h>
+#include "plant_vision.h"
+#include "frame_histogram.h"
+
+/**
+ * @brief Name of the shared memory object holding the metadata page
+ */
+#define CAMERA_METADATA_SHM_NAME "/camera_metadata"
+
+/**
+ * @brief Value of @c Metadata::magic once the writer has initialised the page
+ *
+ * The writer clears it again when it stops or a new writer replaces the page.
+ */
+#define CAMERA_METADATA_MAGIC (0x434d4554u)
+
+/**
+ * @brief Layout of the metadata page shared between the camera writer and readers
+ *
+ * The descriptive fields are only valid while holding @c lock, or as part of a
+ * snapshot returned by @c camera_metadata_wait. Every published frame
+ * increments @c sequence and broadcasts @c frame_ready. @c vision and
+ * @c histogram come last so the offsets of the older fields stay the same for
+ * existing readers. @c histogram is updated on its own, without a new
+ * sequence, and read with @c camera_metadata_read_histogram.
+ */
+typedef struct {
+    camera_frametype_t frametype;
+    uint32_t width;
+    uint32_t height;
+    size_t size;
+    uint32_t magic;
+    uint32_t writer_pid;
+    uint64_t sequence;
+    int64_t timestamp;
+    pthread_mutex_t lock;
+    pthread_cond_t frame_ready;
+    PlantVisionMetrics vision;
+    FrameHistogram histogram;
+} Metadata;
+
+/**
+ * @brief Plain copy of the descriptive fields of @c Metadata
+ */
+typedef struct {
+    camera_frametype_t frametype;
+    uint32_t width;
+    uint32_t height;
+    size_t size;
+    uint64_t sequence;
+    int64_t timestamp;
+    PlantVisionMetrics vision;
+} MetadataSnapshot;
+
+/**
+ * @brief Creates and maps the metadata page, initialising the process-shared
+ *        mutex and condition variable
+ *
+ * A page left under the same name by an earlier writer is retired and
+ * unlinked, and a new one is created in its place.
+ *
+ * @param name Shared memory object name
+ * @return Mapped page, or NULL on failure
+ */
+Metadata* camera_metadata_create(const char* name);
+
+/**
+ * @brief Maps an existing metadata page created by the camera writer
+ *
+ * @param name Shared memory object name
+ * @return Mapped page, or NULL if it does not exist or is not initialised yet
+ */
+Metadata* camera_metadata_open(const char* name);
+
+/**
+ * @brief Unmaps a page returned by @c camera_metadata_create or @c camera_metadata_open
+ */
+void camera_metadata_close(Metadata* metadata);
+
+/**
+ * @brief Retires a page returned by @c camera_metadata_create, waking its readers, then unmaps and unlinks it
+ */
+void camera_metadata_destroy(Metadata* metadata, const char* name);
+
+/**
+ * @brief Publishes a new frame description and wakes every waiting reader
+ *
+ * @param vision Plant metrics of the frame or an earlier one; NULL keeps the previous metrics
+ * @return The sequence number assigned to the frame
+ */
+uint64_t camera_metadata_publish(Metadata* metadata, camera_frametype_t frametype,
+                                 uint32_t width, uint32_t height, size_t size, int64_t timestamp,
+                                 const PlantVisionMetrics* vision);
+
+/**
+ * @brief Replaces the histogram on the page without waking readers
+ */
+void camera_metadata_publish_histogram(Metadata* metadata, const FrameHistogram* histogram);
+
+/**
+ * @brief Copies the latest histogram from the page
+ *
+ * @return 0 on success, or an errno value if the page could not be locked
+ */
+int camera_metadata_read_histogram(Metadata* metadata, FrameHistogram* histogram);
+
+/**
+ * @brief Blocks until a frame newer than @c last_sequence is published
+ *
+ * @param metadata Mapped metadata page
+ * @param last_sequence Sequence number of the last frame the caller has seen (0 for none)
+ * @param timeout_ms Maximum time to wait in milliseconds; negative waits forever
+ * @param snapshot Receives the frame description on success; may be NULL
+ * @return 0 on success, ETIMEDOUT if no new frame arrived in time, ESTALE if the
+ *         writer stopped or restarted (close the page and open the name again), or
+ *         another errno value. A writer that dies is only noticed when the wait
+ *         times out, so pass a timeout to notice it.
+ */
+int camera_metadata_wait(Metadata* metadata, uint64_t last_sequence, int timeout_ms,
+                         MetadataSnapshot* snapshot);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "camera_pipeline.h"
+#include "thread_sched.h"
+
+/**
+ * @brief Connects the pipeline's stream socket to the host
+ */
+static int connectStream(CameraPipeline* pipeline)
+{
+    pipeline->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (pipeline->sock == -1) {
+        printf("Failed to create socket\n");
+        return -1;
+    }
+    struct sockaddr_in server;
+    memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_addr.s_addr = inet_addr(pipeline->config.host);
+    server.sin_port = htons(pipeline->config.port);
+    if (connect(pipeline->sock, (struct sockaddr*)&server, sizeof(server)) < 0) {
+        printf("Failed to connect to host %s:%u\n", pipeline->config.host, (unsigned)pipeline->config.port);
+        close(pipeline->sock);
+        pipeline->sock = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static const char* const cThreadNames[PIPELINE_THREAD_COUNT] = {
+    "callback",
+    "encoder",
+    "sender",
+    "background",
+    "histogram",
+};
+
+/**
+ * @brief Applies the scheduling configured for @c role to one thread, reporting failures
+ */
+static void scheduleThread(CameraPipeline* pipeline, pthread_t thread, PipelineThread role)
+{
+    int err = thread_sched_apply(thread, &pipeline->config.sched[role]);
+    if (err != 0) {
+        printf("Failed to schedule %s thread of CAMERA_UNIT_%d: %s\n", cThreadNames[role],
+               (int)pipeline->config.unit, strerror(err));
+    }
+}
+
+/**
+ * @brief Applies the configured policy, priority and affinity to every consumer thread of the pipeline
+ */
+static void scheduleThreads(CameraPipeline* pipeline)
+{
+    scheduleThread(pipeline, pipeline->stream.encoder_thread, PIPELINE_THREAD_ENCODER);
+    scheduleThread(pipeline, pipeline->stream.sender_thread, PIPELINE_THREAD_SENDER);
+    if (pipeline->recording && (pipeline->config.recorder_mode == FLIGHT_RECORDER_RAW)) {
+        scheduleThread(pipeline, pipeline->recorder.thread, PIPELINE_THREAD_BACKGROUND);
+    }
+    if (pipeline->capturing) {
+        scheduleThread(pipeline, pipeline->capture.compressor_thread, PIPELINE_THREAD_BACKGROUND);
+        scheduleThread(pipeline, pipeline->capture.writer_thread, PIPELINE_THREAD_BACKGROUND);
+    }
+    if (pipeline->histogramming) {
+        for (int i = 0; i < pipeline->histogram.started; i++) {
+            scheduleThread(pipeline, pipeline->histogram.workers[i].thread, PIPELINE_THREAD_HISTOGRAM);
+        }
+    }
+}
+
+/**
+ * @brief Writes the name of the latest frame object into "<prefix>_latest_name"
+ */
+static void publishLatestName(CameraPipeline* pipeline)
+{
+    int name_fd = shm_open(pipeline->latest_name_name, O_CREAT | O_RDWR, 0666);
+    if (name_fd != -1) {
+        if (ftruncate(name_fd, 256) != -1) {
+            char* name_mapped = mmap(NULL, 256, PROT_READ | PROT_WRITE, MAP_SHARED, name_fd, 0);
+            if (name_mapped != MAP_FAILED) {
+                strncpy(name_mapped, pipeline->latest_name, 256);
+                munmap(name_mapped, 256);
+            }
+        }
+        close(name_fd);
+    }
+}
+
+/**
+ * @brief (Re)creates the "<prefix>_latest" object so it can hold @c size bytes
+ *
+ * @return 0 on success, -1 on failure
+ */
+static int reserveLatest(CameraPipeline* pipeline, size_t size)
+{
+    frame_memory_free(pipeline->latest_mapped, pipeline->latest_size);
+    pipeline->latest_mapped = NULL;
+    pipeline->latest_size = 0;
+
+    int latest_fd = shm_open(pipeline->latest_name, O_CREAT | O_RDWR, 0666);
+    if (latest_fd == -1) {
+        return -1;
+    }
+    size_t latest_size = size;
+    pipeline->latest_mapped = frame_memory_map_shared(latest_fd, &latest_size, pipeline->config.memory_flags);
+    close(latest_fd);
+    if (pipeline->latest_mapped == NULL) {
+        return -1;
+    }
+    pipeline->latest_size = latest_size;
+    return 0;
+}
+
+void camera_pipeline_publish_latest(CameraPipeline* pipeline, const camera_buffer_t* buffer, size_t size)
+{
+    if (pipeline->latest_size < size) {
+        frame_arena_count_allocation(&pipeline->arena);
+        if (reserveLatest(pipeline, size) != 0) {
+            return;
+        }
+    }
+    memcpy(pipeline->latest_mapped, buffer->framebuf, size);
+}
+
+static const char* const cStageNames[PIPELINE_STAGE_COUNT] = {
+    "ring",
+    "latest",
+    "metadata",
+    "stats",
+    "vision",
+    "stream",
+    "recorder",
+    "capture",
+    "histogram",
+};
+
+const char* camera_pipeline_stage_name(PipelineStage stage)
+{
+    return (stage < PIPELINE_STAGE_COUNT) ? cStageNames[stage] : "unknown";
+}
+
+const char* camera_pipeline_thread_name(PipelineThread thread)
+{
+    return (thread < PIPELINE_THREAD_COUNT) ? cThreadNames[thread] : "unknown";
+}
+
+void camera_pipeline_schedule_callback(CameraPipeline* pipeline)
+{
+    if (!pipeline->callback_scheduled) {
+        scheduleThread(pipeline, pthread_self(), PIPELINE_THREAD_CALLBACK);
+        pipeline->callback_scheduled = true;
+    }
+}
+
+int camera_pipeline_start(CameraPipeline* pipeline, const CameraPipelineConfig* config)
+{
+    char ring_prefix[64];
+
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->config = *config;
+    pipeline->handle = CAMERA_HANDLE_INVALID;
+    pipeline->sock = -1;
+    frame_arena_init(&pipeline->arena, config->memory_flags);
+    memcpy(pipeline->callback_rates, config->rates, sizeof(pipeline->callback_rates));
+    snprintf(pipeline->metadata_name, sizeof(pipeline->metadata_name), "%s_metadata", config->shm_prefix);
+    snprintf(pipeline->latest_name, sizeof(pipeline->latest_name), "%s_latest", config->shm_prefix);
+    snprintf(pipeline->latest_name_name, sizeof(pipeline->latest_name_name), "%s_latest_name", config->shm_prefix);
+    snprintf(ring_prefix, sizeof(ring_prefix), "%s_frame_", config->shm_prefix);
+
+    // Create shared memory for metadata; readers block on it for new frames
+    pipeline->metadata = camera_metadata_create(pipeline->metadata_name);
+    if (pipeline->metadata == NULL) {
+        return -1;
+    }
+
+    publishLatestName(pipeline);
+
+    // Size the frame buffers up front when the resolution is known
+    if ((config->frame_width != 0) && (config->frame_height != 0)
+        && (frame_arena_reserve(&pipeline->arena, config->frame_width, config->frame_height) != 0)) {
+        camera_pipeline_stop(pipeline);
+        return -1;
+    }
+
+    // Connect to host for JPEG streaming
+    if (config->host && (connectStream(pipeline) != 0)) {
+        camera_pipeline_stop(pipeline);
+        return -1;
+    }
+
+    // Set up the frame ring and the threads that consume it
+    if (frame_ring_init(&pipeline->ring, ring_prefix, &pipeline->arena) != 0) {
+        printf("Failed to initialize frame ring\n");
+        camera_pipeline_stop(pipeline);
+        return -1;
+    }
+    pipeline->ring_ready = true;
+    if ((config->frame_width != 0) && (config->frame_height != 0)) {
+        // Room for the largest supported frametype at 4 bytes per pixel
+        size_t frame_size = (size_t)config->frame_width * config->frame_height * 4;
+        if ((frame_ring_reserve(&pipeline->ring, frame_size) != 0) || (reserveLatest(pipeline, frame_size) != 0)) {
+            printf("Failed to reserve frame memory\n");
+            camera_pipeline_stop(pipeline);
+            return -1;
+        }
+    }
+    if (config->recorder_path) {
+        if (flight_recorder_open(&pipeline->recorder, config->recorder_path, config->recorder_size,
+                                 config->recorder_mode) != 0) {
+            camera_pipeline_stop(pipeline);
+            return -1;
+        }
+        pipeline->recording = true;
+        if ((config->recorder_mode == FLIGHT_RECORDER_RAW)
+            && (flight_recorder_start(&pipeline->recorder, &pipeline->ring, &config->rates[PIPELINE_STAGE_RECORDER]) != 0)) {
+            camera_pipeline_stop(pipeline);
+            return -1;
+        }
+    }
+    FlightRecorder* jpeg_recorder = NULL;
+    if (pipeline->recording && (config->recorder_mode == FLIGHT_RECORDER_JPEG)) {
+        jpeg_recorder = &pipeline->recorder;
+    }
+    if (jpeg_stream_start(&pipeline->stream, &pipeline->ring, &pipeline->arena, pipeline->sock, jpeg_recorder,
+                          &config->rates[PIPELINE_STAGE_STREAM], &config->rates[PIPELINE_STAGE_RECORDER]) != 0) {
+        camera_pipeline_stop(pipeline);
+        return -1;
+    }
+    pipeline->streaming = true;
+    if (config->capture_path) {
+        if (frame_capture_start(&pipeline->capture, config->capture_path, &pipeline->ring,
+                                &config->rates[PIPELINE_STAGE_CAPTURE]) == 0) {
+            pipeline->capturing = true;
+        } else {
+            printf("Continuing without capture\n");
+        }
+    }
+    if (config->histogram.workers > 0) {
+        if (histogram_engine_start(&pipeline->histogram, &config->histogram, &pipeline->ring, pipeline->metadata,
+                                   &config->rates[PIPELINE_STAGE_HISTOGRAM]) == 0) {
+            pipeline->histogramming = true;
+        } else {
+            printf("Continuing without histograms\n");
+        }
+    }
+
+    scheduleThreads(pipeline);
+
+    return 0;
+}
+
+void camera_pipeline_stop(CameraPipeline* pipeline)
+{
+    // Stop the consumers before the ring slots they hold are released
+    if (pipeline->ring_ready) {
+        frame_ring_stop(&pipeline->ring);
+        if (pipeline->streaming) {
+            jpeg_stream_stop(&pipeline->stream);
+            pipeline->streaming = false;
+        }
+        if (pipeline->capturing) {
+            frame_capture_stop(&pipeline->capture);
+            pipeline->capturing = false;
+        }
+        if (pipeline->histogramming) {
+            histogram_engine_stop(&pipeline->histogram);
+            pipeline->histogramming = false;
+        }
+        if (pipeline->recording) {
+            flight_recorder_close(&pipeline->recorder);
+            pipeline->recording = false;
+        }
+        frame_ring_destroy(&pipeline->ring);
+        pipeline->ring_ready = false;
+    }
+
+    // Free shared memory
+    if (pipeline->metadata) {
+        camera_metadata_destroy(pipeline->metadata, pipeline->metadata_name);
+        pipeline->metadata = NULL;
+    }
+    frame_memory_free(pipeline->latest_mapped, pipeline->latest_size);
+    pipeline->latest_mapped = NULL;
+    shm_unlink(pipeline->latest_name);
+    shm_unlink(pipeline->latest_name_name);
+    if (atomic_load(&pipeline->arena.steady_allocations) != 0) {
+        printf("CAMERA_UNIT_%d allocated %llu times after warm-up\n", (int)pipeline->config.unit,
+               (unsigned long long)atomic_load(&pipeline->arena.steady_allocations));
+    }
+    frame_arena_destroy(&pipeline->arena);
+    if (pipeline->sock != -1) {
+        close(pipeline->sock);
+        pipeline->sock = -1;
+    }
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAMERA_PIPELINE_H
+#define CAMERA_PIPELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <camera/camera_api.h>
+#include "camera_metadata.h"
+#include "frame_ring.h"
+#include "frame_arena.h"
+#include "jpeg_stream.h"
+#include "flight_recorder.h"
+#include "frame_capture.h"
+#include "thread_sched.h"
+#include "stage_rate.h"
+#include "adaptive_rate.h"
+#include "plant_vision.h"
+#include "histogram_engine.h"
+#include "frame_stats.h"
+
+/**
+ * @brief Maximum number of camera units a single process drives
+ */
+#define MAX_PIPELINES (4)
+
+/**
+ * @brief Threads of a pipeline whose scheduling can be configured
+ *
+ * @c PIPELINE_THREAD_BACKGROUND covers the flight recorder and capture threads,
+ * @c PIPELINE_THREAD_HISTOGRAM every thread of the histogram engine.
+ */
+typedef enum {
+    PIPELINE_THREAD_CALLBACK,
+    PIPELINE_THREAD_ENCODER,
+    PIPELINE_THREAD_SENDER,
+    PIPELINE_THREAD_BACKGROUND,
+    PIPELINE_THREAD_HISTOGRAM,
+    PIPELINE_THREAD_COUNT
+} PipelineThread;
+
+/**
+ * @brief Processing stages of a pipeline that can be decimated
+ *
+ * The first five run on the camera callback thread, the others on their own
+ * threads and only ever see frames that made it into the ring.
+ */
+typedef enum {
+    PIPELINE_STAGE_RING,
+    PIPELINE_STAGE_LATEST,
+    PIPELINE_STAGE_METADATA,
+    PIPELINE_STAGE_STATS,
+    PIPELINE_STAGE_VISION,
+    PIPELINE_STAGE_STREAM,
+    PIPELINE_STAGE_RECORDER,
+    PIPELINE_STAGE_CAPTURE,
+    PIPELINE_STAGE_HISTOGRAM,
+    PIPELINE_STAGE_COUNT
+} PipelineStage;
+
+/**
+ * @brief Per-unit configuration of a camera pipeline
+ *
+ * A NULL @c host leaves the JPEG stream unconnected: the JPEGs are still
+ * encoded and recorded but not sent anywhere.
+ */
+typedef struct {
+    camera_unit_t unit;
+    char shm_prefix[32];
+    const char* host;
+    uint16_t port;
+    ThreadSchedConfig sched[PIPELINE_THREAD_COUNT];
+    StageRate rates[PIPELINE_STAGE_COUNT];
+    AdaptiveRateConfig adaptive;
+    uint32_t frame_width;
+    uint32_t frame_height;
+    unsigned memory_flags;
+    const char* recorder_path;
+    size_t recorder_size;
+    FlightRecorderMode recorder_mode;
+    const char* capture_path;
+    HistogramConfig histogram;
+    uint32_t stats_step;
+} CameraPipelineConfig;
+
+/**
+ * @brief Everything one camera unit needs: its shared memory, ring, consumers and stream
+ *
+ * All shared memory objects are named after @c CameraPipelineConfig::shm_prefix,
+ * e.g. "<prefix>_metadata", "<prefix>_frame_<n>" and "<prefix>_latest", so
+ * several pipelines can run side by side in one process. The frame hot path
+ * takes its buffers from @c arena and keeps its shared memory mapped, so it
+ * does not allocate once the first frame has gone through.
+ */
+typedef struct {
+    CameraPipelineConfig config;
+    camera_handle_t handle;
+    char metadata_name[64];
+    char latest_name[64];
+    char latest_name_name[64];
+    Metadata* metadata;
+    uint8_t* latest_mapped;
+    size_t latest_size;
+    int sock;
+    FrameArena arena;
+    FrameRing ring;
+    bool ring_ready;
+    JpegStream stream;
+    bool streaming;
+    FlightRecorder recorder;
+    bool recording;
+    FrameCaptureWriter capture;
+    bool capturing;
+    HistogramEngine histogram;
+    bool histogramming;
+    AdaptiveRate adaptive;
+    bool adapting;
+    bool callback_scheduled;
+    StageRate callback_rates[PIPELINE_STAGE_VISION + 1];
+    const FrameStatsKernel* stats_kernel;
+    camera_frametype_t stats_frametype;
+    PlantVisionMetrics vision;
+} CameraPipeline;
+
+/**
+ * @brief Creates the pipeline's shared memory, connects its stream and starts its consumer threads
+ *
+ * When @c CameraPipelineConfig::frame_width and @c frame_height are known the
+ * frame buffers are sized here, otherwise from the first frame.
+ *
+ * @return 0 on success, -1 on failure (everything already set up is torn down again)
+ */
+int camera_pipeline_start(CameraPipeline* pipeline, const CameraPipelineConfig* config);
+
+/**
+ * @brief Copies a frame into the "<prefix>_latest" shared memory object
+ *
+ * The object stays mapped and is only recreated when a frame outgrows it.
+ */
+void camera_pipeline_publish_latest(CameraPipeline* pipeline, const camera_buffer_t* buffer, size_t size);
+
+/**
+ * @brief Name of a pipeline thread as used on the command line, e.g. "encoder"
+ */
+const char* camera_pipeline_thread_name(PipelineThread thread);
+
+/**
+ * @brief Name of a pipeline stage as used on the command line, e.g. "stream"
+ */
+const char* camera_pipeline_stage_name(PipelineStage stage);
+
+/**
+ * @brief Decides whether a callback-thread stage runs for a frame
+ *
+ * Only valid for the stages up to @c PIPELINE_STAGE_VISION, and only from the callback thread.
+ */
+static inline bool camera_pipeline_stage_due(CameraPipeline* pipeline, PipelineStage stage, int64_t timestamp_us)
+{
+    return stage_rate_due(&pipeline->callback_rates[stage], timestamp_us);
+}
+
+/**
+ * @brief Applies the configured scheduling to the calling thread, which delivers camera callbacks
+ *
+ * libcamapi owns the callback thread, so this is called from its first callback.
+ */
+void camera_pipeline_schedule_callback(CameraPipeline* pipeline);
+
+/**
+ * @brief Stops the consumer threads and releases every pipeline resource
+ *
+ * No camera callbacks may be delivered to the pipeline any more.
+ */
+void camera_pipeline_stop(CameraPipeline* pipeline);
+
+#endif
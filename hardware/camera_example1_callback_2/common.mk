@@ -28,9 +28,12 @@ endef
 # The location to install the built binary on a target
 INSTALLDIR = usr/bin
 
+# The GPIO client (rpi_gpio_client.c) and its headers live in motor_controls
+EXTRA_INCVPATH += $(PROJECT_ROOT)/../motor_controls
+
 # Further QNX makefile definitions
 include $(MKFILES_ROOT)/qmacros.mk
 include $(MKFILES_ROOT)/qtargets.mk
 
 # A space-separated list of libraries to be linked
-LIBS += camapi
+LIBS += camapi jpeg lz4 m
@@ -0,0 +1,479 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "flight_recorder.h"
+
+/**
+ * @brief Smallest record the index is sized for; smaller records just wrap the index sooner
+ */
+#define FLIGHT_RECORDER_MIN_RECORD (16 * 1024)
+
+/**
+ * @brief Lower bound on the number of index entries
+ */
+#define FLIGHT_RECORDER_MIN_INDEX (1024)
+
+/**
+ * @brief How long the recorder thread waits for a frame before rechecking for shutdown
+ */
+#define FLIGHT_RECORDER_WAIT_MS (100)
+
+/**
+ * @brief Camera timestamps are in microseconds
+ */
+#define TIMESTAMP_PER_SECOND (1000000LL)
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+static FlightRecorderEntry* entrySlot(const FlightRecorder* recorder, uint64_t entry)
+{
+    return &recorder->index[entry % recorder->header->index_count];
+}
+
+/**
+ * @brief Starts changing an index slot, or the data of its entry
+ *
+ * The release fence keeps the odd generation ahead of every store that follows.
+ */
+static void beginChange(FlightRecorderEntry* slot)
+{
+    __atomic_store_n(&slot->generation, slot->generation + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void endChange(FlightRecorderEntry* slot)
+{
+    __atomic_store_n(&slot->generation, slot->generation + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Checks that nothing changed an index slot since its generation was read
+ */
+static bool unchangedSince(const FlightRecorderEntry* slot, uint32_t generation)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->generation, __ATOMIC_RELAXED) == generation;
+}
+
+/**
+ * @brief Marks an entry as overwritten
+ */
+static void retireEntry(FlightRecorderEntry* slot)
+{
+    beginChange(slot);
+    slot->flags &= ~FLIGHT_RECORDER_ENTRY_VALID;
+    endChange(slot);
+}
+
+static bool overlaps(const FlightRecorderEntry* entry, uint64_t begin, uint64_t end)
+{
+    return (entry->offset < end) && (begin < entry->offset + entry->size);
+}
+
+/**
+ * @brief Finds the oldest entry that still holds valid data
+ */
+static uint64_t findOldestEntry(const FlightRecorder* recorder)
+{
+    uint64_t next = recorder->header->next_entry;
+    uint64_t oldest = (next > recorder->header->index_count) ? next - recorder->header->index_count : 0;
+
+    while ((oldest < next) && !(entrySlot(recorder, oldest)->flags & FLIGHT_RECORDER_ENTRY_VALID)) {
+        oldest++;
+    }
+    return oldest;
+}
+
+/**
+ * @brief Maps the whole file and sets up the header, index and data pointers
+ */
+static int mapFile(FlightRecorder* recorder, size_t size, int prot)
+{
+    recorder->mapped = mmap(NULL, size, prot, MAP_SHARED, recorder->fd, 0);
+    if (recorder->mapped == MAP_FAILED) {
+        recorder->mapped = NULL;
+        return -1;
+    }
+    recorder->mapped_size = size;
+    recorder->header = (FlightRecorderHeader*)recorder->mapped;
+    recorder->index = (FlightRecorderEntry*)(recorder->mapped + sizeof(FlightRecorderHeader));
+    recorder->data = recorder->mapped + recorder->header->data_offset;
+    return 0;
+}
+
+int flight_recorder_open(FlightRecorder* recorder, const char* path, size_t data_size, FlightRecorderMode mode)
+{
+    FlightRecorderHeader header;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->mode = mode;
+    recorder->page_size = page_size;
+
+    memset(&header, 0, sizeof(header));
+    header.magic = FLIGHT_RECORDER_MAGIC;
+    header.version = FLIGHT_RECORDER_VERSION;
+    header.data_size = alignUp(data_size, page_size);
+    header.index_count = header.data_size / FLIGHT_RECORDER_MIN_RECORD;
+    if (header.index_count < FLIGHT_RECORDER_MIN_INDEX) {
+        header.index_count = FLIGHT_RECORDER_MIN_INDEX;
+    }
+    header.data_offset = alignUp(sizeof(FlightRecorderHeader) + header.index_count * sizeof(FlightRecorderEntry),
+                                 page_size);
+    size_t file_size = header.data_offset + header.data_size;
+
+    recorder->fd = open(path, O_CREAT | O_RDWR, 0644);
+    if (recorder->fd == -1) {
+        printf("Failed to open flight recorder %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Keep the existing recording if the file has the same geometry
+    FlightRecorderHeader existing;
+    bool reuse = (pread(recorder->fd, &existing, sizeof(existing), 0) == sizeof(existing))
+              && (existing.magic == header.magic) && (existing.version == header.version)
+              && (existing.data_size == header.data_size) && (existing.index_count == header.index_count)
+              && (existing.data_offset == header.data_offset);
+
+    if (!reuse) {
+        // Allocate every block up front so appends never extend the file
+        if (ftruncate(recorder->fd, 0) == -1 || ftruncate(recorder->fd, file_size) == -1) {
+            printf("Failed to size flight recorder %s: %s\n", path, strerror(errno));
+            close(recorder->fd);
+            return -1;
+        }
+        int err = posix_fallocate(recorder->fd, 0, file_size);
+        if ((err != 0) && (err != EINVAL) && (err != EOPNOTSUPP)) {
+            printf("Failed to preallocate flight recorder %s: %s\n", path, strerror(err));
+            close(recorder->fd);
+            return -1;
+        }
+        if (pwrite(recorder->fd, &header, sizeof(header), 0) != sizeof(header)) {
+            close(recorder->fd);
+            return -1;
+        }
+    }
+
+    if (mapFile(recorder, file_size, PROT_READ | PROT_WRITE) != 0) {
+        printf("Failed to mmap flight recorder %s\n", path);
+        close(recorder->fd);
+        return -1;
+    }
+
+    // Records are appended strictly in order and read back rarely
+    (void)posix_madvise(recorder->data, recorder->header->data_size, POSIX_MADV_SEQUENTIAL);
+
+    recorder->oldest_entry = findOldestEntry(recorder);
+    pthread_mutex_init(&recorder->lock, NULL);
+    atomic_init(&recorder->running, false);
+
+    return 0;
+}
+
+int flight_recorder_open_readonly(FlightRecorder* recorder, const char* path)
+{
+    FlightRecorderHeader header;
+
+    memset(recorder, 0, sizeof(*recorder));
+    recorder->fd = open(path, O_RDONLY);
+    if (recorder->fd == -1) {
+        printf("Failed to open flight recorder %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if ((pread(recorder->fd, &header, sizeof(header), 0) != sizeof(header))
+        || (header.magic != FLIGHT_RECORDER_MAGIC) || (header.version != FLIGHT_RECORDER_VERSION)) {
+        printf("%s is not a flight recorder file\n", path);
+        close(recorder->fd);
+        return -1;
+    }
+    if (mapFile(recorder, header.data_offset + header.data_size, PROT_READ) != 0) {
+        printf("Failed to mmap flight recorder %s\n", path);
+        close(recorder->fd);
+        return -1;
+    }
+
+    recorder->oldest_entry = findOldestEntry(recorder);
+    pthread_mutex_init(&recorder->lock, NULL);
+    atomic_init(&recorder->running, false);
+
+    return 0;
+}
+
+void flight_recorder_close(FlightRecorder* recorder)
+{
+    if (atomic_load(&recorder->running)) {
+        atomic_store(&recorder->running, false);
+        pthread_join(recorder->thread, NULL);
+    }
+    if (recorder->mapped) {
+        (void)msync(recorder->mapped, recorder->mapped_size, MS_ASYNC);
+        munmap(recorder->mapped, recorder->mapped_size);
+        recorder->mapped = NULL;
+    }
+    if (recorder->fd != -1) {
+        close(recorder->fd);
+        recorder->fd = -1;
+    }
+    pthread_mutex_destroy(&recorder->lock);
+}
+
+int flight_recorder_append(FlightRecorder* recorder, const uint8_t* data, size_t size, FlightRecorderEntry entry)
+{
+    FlightRecorderHeader* header = recorder->header;
+
+    if ((size == 0) || (size > header->data_size)) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&recorder->lock);
+
+    uint64_t next = header->next_entry;
+
+    // Camera timestamps start again after a reboot, and the index is only
+    // searchable while they grow, so a run whose first record is older than
+    // the newest one kept from an earlier run retires that run's records.
+    if (!recorder->appended) {
+        recorder->appended = true;
+        FlightRecorderEntry* newest = (recorder->oldest_entry < next) ? entrySlot(recorder, next - 1) : NULL;
+        if (newest && (newest->flags & FLIGHT_RECORDER_ENTRY_VALID) && (newest->timestamp > entry.timestamp)) {
+            printf("Discarding %" PRIu64 " frames recorded before the camera clock restarted\n",
+                   next - recorder->oldest_entry);
+            while (recorder->oldest_entry < next) {
+                retireEntry(entrySlot(recorder, recorder->oldest_entry));
+                recorder->oldest_entry++;
+            }
+        }
+    }
+
+    uint64_t tail = header->write_offset;
+    uint64_t offset = tail;
+    bool wrapped = (offset + size > header->data_size);
+    if (wrapped) {
+        offset = 0;
+    }
+    uint64_t end = offset + size;
+
+    // Retire the oldest records whose bytes are about to be overwritten, plus
+    // the ones in the unused tail skipped by wrapping, and the index slot
+    // this record is going to reuse.
+    while (recorder->oldest_entry < next) {
+        FlightRecorderEntry* oldest = entrySlot(recorder, recorder->oldest_entry);
+        bool evict = !(oldest->flags & FLIGHT_RECORDER_ENTRY_VALID)
+                  || (next - recorder->oldest_entry >= header->index_count)
+                  || overlaps(oldest, offset, end)
+                  || (wrapped && overlaps(oldest, tail, header->data_size));
+        if (!evict) {
+            break;
+        }
+        retireEntry(oldest);
+        recorder->oldest_entry++;
+    }
+
+    // One copy into the page cache; start write-back now so dirty pages
+    // trickle out instead of being flushed in one burst later.
+    memcpy(recorder->data + offset, data, size);
+    uint64_t sync_begin = offset / recorder->page_size * recorder->page_size;
+    (void)msync(recorder->data + sync_begin, end - sync_begin, MS_ASYNC);
+
+    FlightRecorderEntry* slot = entrySlot(recorder, next);
+    beginChange(slot);
+    entry.number = next;
+    entry.generation = slot->generation;
+    entry.offset = offset;
+    entry.size = (uint32_t)size;
+    entry.flags |= FLIGHT_RECORDER_ENTRY_VALID;
+    *slot = entry;
+    endChange(slot);
+
+    header->write_offset = end;
+    __atomic_store_n(&header->next_entry, next + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&recorder->lock);
+
+    return 0;
+}
+
+/**
+ * @brief Appends a raw ring frame to the recorder
+ */
+static void recordFrame(FlightRecorder* recorder, const Frame* frame)
+{
+    FlightRecorderEntry entry = {
+        .sequence = frame->sequence,
+        .timestamp = frame->timestamp,
+        .frametype = (uint32_t)frame->frametype,
+    };
+    frame_get_dimensions(frame->frametype, &frame->framedesc, &entry.width, &entry.height, &entry.stride);
+    (void)flight_recorder_append(recorder, frame->mapped_data, frame->data_size, entry);
+}
+
+static void* recorderThread(void* arg)
+{
+    FlightRecorder* recorder = (FlightRecorder*)arg;
+    uint64_t last_sequence = 0;
+    uint64_t last_recorded = 0;
+    bool full_rate = false;
+
+    while (atomic_load_explicit(&recorder->running, memory_order_relaxed)) {
+        Frame* frame = frame_ring_wait_latest(recorder->ring, last_sequence, FLIGHT_RECORDER_WAIT_MS);
+        if (frame == NULL) {
+            continue;
+        }
+        last_sequence = frame->sequence;
+
+        // When a burst starts, first keep the frames leading up to it that
+        // the idle rate skipped but the ring still holds
+        bool was_full_rate = full_rate;
+        full_rate = stage_rate_full(&recorder->rate);
+        if (full_rate && !was_full_rate) {
+            Frame* history[MAX_FRAMES];
+            int count = frame_ring_acquire_since(recorder->ring, last_recorded, history);
+            for (int i = 0; i < count; i++) {
+                if (history[i]->sequence < frame->sequence) {
+                    recordFrame(recorder, history[i]);
+                    last_recorded = history[i]->sequence;
+                }
+                frame_ring_release(history[i]);
+            }
+        }
+
+        if (!stage_rate_due(&recorder->rate, frame->timestamp)) {
+            frame_ring_release(frame);
+            continue;
+        }
+        recordFrame(recorder, frame);
+        last_recorded = frame->sequence;
+        frame_ring_release(frame);
+    }
+
+    return NULL;
+}
+
+int flight_recorder_start(FlightRecorder* recorder, FrameRing* ring, const StageRate* rate)
+{
+    if (recorder->mode != FLIGHT_RECORDER_RAW) {
+        return -1;
+    }
+    recorder->ring = ring;
+    if (rate) {
+        recorder->rate = *rate;
+    } else {
+        stage_rate_init(&recorder->rate);
+    }
+    atomic_store(&recorder->running, true);
+    if (pthread_create(&recorder->thread, NULL, recorderThread, recorder) != 0) {
+        printf("Failed to create flight recorder thread\n");
+        atomic_store(&recorder->running, false);
+        return -1;
+    }
+    return 0;
+}
+
+uint64_t flight_recorder_find(const FlightRecorder* recorder, int64_t since)
+{
+    uint64_t low = recorder->oldest_entry;
+    uint64_t high = __atomic_load_n(&recorder->header->next_entry, __ATOMIC_ACQUIRE);
+
+    // Entries are appended in timestamp order, so the index can be bisected.
+    // Only the oldest entries are overwritten, so those count as too old.
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        FlightRecorderEntry entry;
+        if ((flight_recorder_entry(recorder, mid, &entry) != 0) || (entry.timestamp < since)) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+int flight_recorder_entry(const FlightRecorder* recorder, uint64_t entry, FlightRecorderEntry* copy)
+{
+    const FlightRecorderEntry* slot = entrySlot(recorder, entry);
+    uint32_t generation = __atomic_load_n(&slot->generation, __ATOMIC_ACQUIRE);
+
+    if (generation & 1) {
+        return -1;
+    }
+    memcpy(copy, slot, sizeof(*copy));
+    if (!unchangedSince(slot, generation)) {
+        return -1;
+    }
+    copy->generation = generation;
+
+    // The slot may hold an older entry, or a newer one that replaced it
+    return ((copy->number == entry) && (copy->flags & FLIGHT_RECORDER_ENTRY_VALID)) ? 0 : -1;
+}
+
+int flight_recorder_extract(const FlightRecorder* recorder, unsigned seconds, const char* out_dir)
+{
+    uint64_t next = __atomic_load_n(&recorder->header->next_entry, __ATOMIC_ACQUIRE);
+    FlightRecorderEntry newest;
+    if ((next == 0) || (flight_recorder_entry(recorder, next - 1, &newest) != 0)) {
+        return 0;
+    }
+    int64_t since = newest.timestamp - (int64_t)seconds * TIMESTAMP_PER_SECOND;
+
+    int count = 0;
+    int skipped = 0;
+    for (uint64_t i = flight_recorder_find(recorder, since); i < next; i++) {
+        FlightRecorderEntry entry;
+        if (flight_recorder_entry(recorder, i, &entry) != 0) {
+            skipped++;
+            continue;
+        }
+
+        char path[512];
+        snprintf(path, sizeof(path), "%s/frame_%08" PRIu64 "_%" PRId64 ".%s", out_dir, entry.sequence,
+                 entry.timestamp, (entry.flags & FLIGHT_RECORDER_ENTRY_JPEG) ? "jpg" : "raw");
+        int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (fd == -1) {
+            printf("Failed to create %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        ssize_t written = write(fd, recorder->data + entry.offset, entry.size);
+        close(fd);
+
+        // The recorder retires an entry before overwriting its data, so an
+        // unchanged generation means the copy is intact
+        if (!unchangedSince(entrySlot(recorder, i), entry.generation)) {
+            (void)unlink(path);
+            skipped++;
+            continue;
+        }
+        if (written != (ssize_t)entry.size) {
+            printf("Failed to write %s\n", path);
+            return -1;
+        }
+        count++;
+    }
+    if (skipped > 0) {
+        printf("Skipped %d frames overwritten during extraction\n", skipped);
+    }
+
+    return count;
+}
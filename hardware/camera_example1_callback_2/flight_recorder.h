@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <camera/camera_api.h>
+#include "frame_ring.h"
+#include "stage_rate.h"
+
+#define FLIGHT_RECORDER_MAGIC   (0x46524543u)
+#define FLIGHT_RECORDER_VERSION (2)
+
+/**
+ * @brief Flags of a @c FlightRecorderEntry
+ */
+enum {
+    FLIGHT_RECORDER_ENTRY_VALID = 0x1,
+    FLIGHT_RECORDER_ENTRY_JPEG  = 0x2,
+};
+
+/**
+ * @brief What the recorder stores for each frame
+ */
+typedef enum {
+    FLIGHT_RECORDER_RAW,
+    FLIGHT_RECORDER_JPEG,
+} FlightRecorderMode;
+
+/**
+ * @brief File header, stored at offset 0 of the recorder file
+ *
+ * The index is a ring of @c index_count entries that directly follows the
+ * header; entry @c n lives in slot @c n % @c index_count. The data area is a
+ * ring of @c data_size bytes starting at @c data_offset, and each record is
+ * stored contiguously in it.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_offset;
+    uint64_t data_size;
+    uint32_t index_count;
+    uint32_t reserved;
+    uint64_t next_entry;
+    uint64_t write_offset;
+} FlightRecorderHeader;
+
+/**
+ * @brief Index entry describing one recorded frame
+ *
+ * @c generation works as a sequence lock for readers in other processes: the
+ * recorder makes it odd while it rewrites the slot or retires the entry
+ * before its data is overwritten, and even again afterwards. A reader that
+ * sees the same even value before and after copying an entry, or its data,
+ * has an intact copy. @c number is the logical entry number stored in the
+ * slot.
+ */
+typedef struct {
+    uint64_t number;
+    uint32_t generation;
+    uint32_t reserved;
+    uint64_t sequence;
+    int64_t timestamp;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t frametype;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+} FlightRecorderEntry;
+
+/**
+ * @brief Open recorder file
+ */
+typedef struct {
+    int fd;
+    uint8_t* mapped;
+    size_t mapped_size;
+    size_t page_size;
+    FlightRecorderHeader* header;
+    FlightRecorderEntry* index;
+    uint8_t* data;
+    uint64_t oldest_entry;
+    bool appended;
+    FlightRecorderMode mode;
+    FrameRing* ring;
+    StageRate rate;
+    atomic_bool running;
+    pthread_t thread;
+    pthread_mutex_t lock;
+} FlightRecorder;
+
+/**
+ * @brief Creates (or reuses) a preallocated recorder file and maps it
+ *
+ * An existing file with a matching geometry keeps its recorded frames, unless
+ * the first frame recorded now is older than the newest one kept, as after a
+ * reboot restarts the camera clock.
+ *
+ * @param recorder Recorder state
+ * @param path Path of the recorder file on local storage
+ * @param data_size Size of the frame data ring in bytes
+ * @param mode Whether raw frames or encoded JPEGs are recorded
+ * @return 0 on success, -1 on failure
+ */
+int flight_recorder_open(FlightRecorder* recorder, const char* path, size_t data_size, FlightRecorderMode mode);
+
+/**
+ * @brief Maps an existing recorder file read-only, for extraction
+ *
+ * @return 0 on success, -1 on failure
+ */
+int flight_recorder_open_readonly(FlightRecorder* recorder, const char* path);
+
+/**
+ * @brief Stops recording and unmaps the file
+ */
+void flight_recorder_close(FlightRecorder* recorder);
+
+/**
+ * @brief Appends one record, overwriting the oldest ones as needed
+ *
+ * Safe to call from several threads.
+ *
+ * @param recorder Recorder state
+ * @param data Record payload (raw frame or JPEG)
+ * @param size Payload size in bytes
+ * @param entry Description of the record; @c offset and @c size are filled in
+ * @return 0 on success, -1 if the record can never fit in the data ring
+ */
+int flight_recorder_append(FlightRecorder* recorder, const uint8_t* data, size_t size, FlightRecorderEntry entry);
+
+/**
+ * @brief Starts a thread that records new ring frames (raw mode only)
+ *
+ * The thread holds a ring handle while copying, so capture is never stalled by
+ * storage; frames arriving faster than they can be written are skipped.
+ *
+ * @param recorder Open recorder
+ * @param ring Ring to take frames from
+ * @param rate Rate at which frames are recorded, or NULL for every frame
+ * @return 0 on success, -1 on failure
+ */
+int flight_recorder_start(FlightRecorder* recorder, FrameRing* ring, const StageRate* rate);
+
+/**
+ * @brief Finds the oldest recorded entry with a timestamp at or after @c since
+ *
+ * Entries overwritten while searching count as older than @c since.
+ *
+ * @return Logical entry number, or @c header->next_entry if there is none
+ */
+uint64_t flight_recorder_find(const FlightRecorder* recorder, int64_t since);
+
+/**
+ * @brief Copies the entry with the given logical number
+ *
+ * @return 0 on success, -1 if it was overwritten or is being overwritten
+ */
+int flight_recorder_entry(const FlightRecorder* recorder, uint64_t entry, FlightRecorderEntry* copy);
+
+/**
+ * @brief Writes the records of the last @c seconds to @c out_dir, one file per frame
+ *
+ * The recorder may keep appending meanwhile. Records it overwrites before or
+ * while they are copied are skipped.
+ *
+ * @return Number of frames extracted, or -1 on failure
+ */
+int flight_recorder_extract(const FlightRecorder* recorder, unsigned seconds, const char* out_dir);
+
+#endif
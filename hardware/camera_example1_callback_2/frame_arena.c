@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_arena.h"
+
+/**
+ * @brief Room for JPEG markers and tables on top of the pixel data
+ */
+#define JPEG_HEADER_MARGIN (64 * 1024)
+
+/**
+ * @brief Alignment of pool blocks
+ */
+#define BLOCK_ALIGNMENT (64)
+
+/**
+ * @brief Allocates @c count blocks of at least @c block_size bytes
+ */
+static int initPool(FramePool* pool, size_t block_size, unsigned count, unsigned flags)
+{
+    block_size = (block_size + BLOCK_ALIGNMENT - 1) & ~(size_t)(BLOCK_ALIGNMENT - 1);
+    size_t mapped_size = block_size * count;
+    uint8_t* base = frame_memory_alloc(&mapped_size, flags);
+    if (base == NULL) {
+        return -1;
+    }
+    pool->base = base;
+    pool->mapped_size = mapped_size;
+    pool->block_size = block_size;
+    pool->block_count = count;
+    atomic_store(&pool->free_mask, (count == 32) ? UINT32_MAX : ((1u << count) - 1));
+    return 0;
+}
+
+static void destroyPool(FramePool* pool)
+{
+    frame_memory_free(pool->base, pool->mapped_size);
+    pool->base = NULL;
+    pool->mapped_size = 0;
+    pool->block_size = 0;
+    pool->block_count = 0;
+    atomic_store(&pool->free_mask, 0);
+}
+
+void frame_arena_init(FrameArena* arena, unsigned memory_flags)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->memory_flags = memory_flags;
+    atomic_init(&arena->rgb.free_mask, 0);
+    atomic_init(&arena->jpeg.free_mask, 0);
+    atomic_init(&arena->sealed, false);
+    atomic_init(&arena->allocations, 0);
+    atomic_init(&arena->steady_allocations, 0);
+}
+
+int frame_arena_reserve(FrameArena* arena, uint32_t width, uint32_t height)
+{
+    size_t rgb_size = (size_t)width * height * 3;
+
+    if ((width == 0) || (height == 0)) {
+        return -1;
+    }
+    destroyPool(&arena->rgb);
+    destroyPool(&arena->jpeg);
+    if ((initPool(&arena->rgb, rgb_size, FRAME_ARENA_RGB_BLOCKS, arena->memory_flags) != 0)
+        || (initPool(&arena->jpeg, rgb_size + JPEG_HEADER_MARGIN, FRAME_ARENA_JPEG_BLOCKS, arena->memory_flags) != 0)) {
+        printf("Failed to allocate frame buffers for %ux%u\n", (unsigned)width, (unsigned)height);
+        destroyPool(&arena->rgb);
+        return -1;
+    }
+    // Both pools count as one reservation
+    frame_arena_count_allocation(arena);
+    return 0;
+}
+
+bool frame_arena_ready(const FrameArena* arena)
+{
+    return arena->jpeg.base != NULL;
+}
+
+void frame_arena_count_allocation(FrameArena* arena)
+{
+    atomic_fetch_add_explicit(&arena->allocations, 1, memory_order_relaxed);
+    if (atomic_load_explicit(&arena->sealed, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&arena->steady_allocations, 1, memory_order_relaxed);
+        // The hot path must not allocate once warm-up is over
+        assert(!"steady-state allocation in the frame hot path");
+    }
+}
+
+void frame_arena_seal(FrameArena* arena)
+{
+    atomic_store_explicit(&arena->sealed, true, memory_order_relaxed);
+}
+
+void frame_arena_destroy(FrameArena* arena)
+{
+    destroyPool(&arena->rgb);
+    destroyPool(&arena->jpeg);
+}
+
+uint8_t* frame_pool_get(FramePool* pool)
+{
+    uint_fast32_t mask = atomic_load_explicit(&pool->free_mask, memory_order_acquire);
+
+    while (mask != 0) {
+        unsigned index = (unsigned)__builtin_ctz((unsigned)mask);
+        if (atomic_compare_exchange_weak_explicit(&pool->free_mask, &mask, mask & ~((uint_fast32_t)1 << index),
+                                                  memory_order_acquire, memory_order_acquire)) {
+            return pool->base + (size_t)index * pool->block_size;
+        }
+    }
+    return NULL;
+}
+
+void frame_pool_put(FramePool* pool, uint8_t* block)
+{
+    if (block == NULL) {
+        return;
+    }
+    unsigned index = (unsigned)((size_t)(block - pool->base) / pool->block_size);
+    atomic_fetch_or_explicit(&pool->free_mask, (uint_fast32_t)1 << index, memory_order_release);
+}
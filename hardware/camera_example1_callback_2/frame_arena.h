@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "frame_memory.h"
+
+/**
+ * @brief Maximum number of blocks in a pool
+ */
+#define FRAME_POOL_MAX_BLOCKS (32)
+
+/**
+ * @brief Pool of equally sized blocks carved out of a single allocation
+ *
+ * Blocks are handed out and returned lock-free, so a block can be taken on
+ * one thread and put back on another.
+ */
+typedef struct {
+    uint8_t* base;
+    size_t mapped_size;
+    size_t block_size;
+    unsigned block_count;
+    atomic_uint_fast32_t free_mask;
+} FramePool;
+
+/**
+ * @brief Per-pipeline buffers of the frame hot path
+ *
+ * The pools are sized once when the stream starts (or from its first frame
+ * when the resolution isn't known up front). Every allocation made on behalf
+ * of the hot path is counted; once the arena is sealed, the count must not
+ * grow, which is asserted in debug builds.
+ */
+typedef struct {
+    FramePool rgb;
+    FramePool jpeg;
+    unsigned memory_flags;
+    atomic_bool sealed;
+    atomic_uint_fast64_t allocations;
+    atomic_uint_fast64_t steady_allocations;
+} FrameArena;
+
+/**
+ * @brief Number of RGB conversion buffers: only the encoder converts frames
+ */
+#define FRAME_ARENA_RGB_BLOCKS (1)
+
+/**
+ * @brief Number of JPEG buffers: one being encoded, one pending and one being sent
+ */
+#define FRAME_ARENA_JPEG_BLOCKS (3)
+
+/**
+ * @brief Initialises an empty arena whose pools are mapped with @c FRAME_MEMORY_* @c memory_flags
+ */
+void frame_arena_init(FrameArena* arena, unsigned memory_flags);
+
+/**
+ * @brief Sizes the pools for frames of up to @c width x @c height pixels
+ *
+ * Must not be called while any block is handed out.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_arena_reserve(FrameArena* arena, uint32_t width, uint32_t height);
+
+/**
+ * @brief Returns true once @c frame_arena_reserve has succeeded
+ */
+bool frame_arena_ready(const FrameArena* arena);
+
+/**
+ * @brief Records an allocation made on behalf of the hot path outside the pools
+ */
+void frame_arena_count_allocation(FrameArena* arena);
+
+/**
+ * @brief Marks the end of warm-up; any further allocation is a steady-state allocation
+ */
+void frame_arena_seal(FrameArena* arena);
+
+/**
+ * @brief Frees the pools; no blocks may be handed out
+ */
+void frame_arena_destroy(FrameArena* arena);
+
+/**
+ * @brief Takes a block from the pool
+ *
+ * @return The block, or NULL if every block is in use
+ */
+uint8_t* frame_pool_get(FramePool* pool);
+
+/**
+ * @brief Returns a block taken with @c frame_pool_get; NULL is ignored
+ */
+void frame_pool_put(FramePool* pool, uint8_t* block);
+
+#endif
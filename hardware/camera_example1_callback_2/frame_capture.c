@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <lz4.h>
+#include "frame_capture.h"
+
+/**
+ * @brief A chunk is handed to the writer once it holds at least this many bytes
+ */
+#define FRAME_CAPTURE_CHUNK_TARGET (8 * 1024 * 1024)
+
+/**
+ * @brief Minimum alignment of the file header and of every chunk
+ */
+#define FRAME_CAPTURE_MIN_ALIGNMENT (4096)
+
+/**
+ * @brief How long the compressor waits for a frame before rechecking for shutdown
+ */
+#define FRAME_CAPTURE_WAIT_MS (100)
+
+static size_t alignUp(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Writes a whole buffer, retrying short writes
+ */
+static int writeAll(int fd, const uint8_t* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+static void resetBuffer(FrameCaptureBuffer* buffer)
+{
+    buffer->used = sizeof(FrameCaptureChunk);
+    buffer->frame_count = 0;
+}
+
+/**
+ * @brief Grows an empty chunk buffer so it can hold at least @c capacity bytes
+ */
+static int reserveBuffer(FrameCaptureWriter* writer, FrameCaptureBuffer* buffer, size_t capacity)
+{
+    if (buffer->capacity >= capacity) {
+        return 0;
+    }
+
+    void* data = NULL;
+    capacity = alignUp(capacity, writer->alignment);
+    if (posix_memalign(&data, writer->alignment, capacity) != 0) {
+        return -1;
+    }
+    free(buffer->data);
+    buffer->data = data;
+    buffer->capacity = capacity;
+    resetBuffer(buffer);
+    return 0;
+}
+
+/**
+ * @brief Seals the current chunk and queues it to the writer thread
+ *
+ * Must be called with the writer lock held.
+ */
+static void submitCurrent(FrameCaptureWriter* writer)
+{
+    FrameCaptureBuffer* buffer = &writer->buffers[writer->current];
+    FrameCaptureChunk chunk = {
+        .magic = FRAME_CAPTURE_CHUNK_MAGIC,
+        .frame_count = buffer->frame_count,
+        .payload_size = buffer->used - sizeof(FrameCaptureChunk),
+    };
+    memcpy(buffer->data, &chunk, sizeof(chunk));
+
+    // Pad to the alignment so every chunk, and so every write, stays aligned
+    size_t padded = alignUp(buffer->used, writer->alignment);
+    memset(buffer->data + buffer->used, 0, padded - buffer->used);
+    buffer->used = padded;
+
+    writer->full_list[writer->full_count++] = writer->current;
+    writer->current = -1;
+    pthread_cond_broadcast(&writer->changed);
+}
+
+/**
+ * @brief Makes sure there is a current chunk with room for a record of @c bound bytes
+ *
+ * @return 0 on success, -1 if no chunk buffer is free and the frame must be dropped
+ */
+static int prepareCurrent(FrameCaptureWriter* writer, size_t bound)
+{
+    pthread_mutex_lock(&writer->lock);
+    if ((writer->current != -1)
+        && (writer->buffers[writer->current].used + bound > writer->buffers[writer->current].capacity)) {
+        submitCurrent(writer);
+    }
+    if (writer->current == -1) {
+        if (writer->free_count == 0) {
+            pthread_mutex_unlock(&writer->lock);
+            return -1;
+        }
+        writer->current = writer->free_list[--writer->free_count];
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    // The current buffer belongs to the compressor, so it can be grown unlocked
+    FrameCaptureBuffer* buffer = &writer->buffers[writer->current];
+    if (buffer->used + bound > buffer->capacity) {
+        size_t target = FRAME_CAPTURE_CHUNK_TARGET + sizeof(FrameCaptureChunk) + bound;
+        if (reserveBuffer(writer, buffer, target) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void* compressorThread(void* arg)
+{
+    FrameCaptureWriter* writer = (FrameCaptureWriter*)arg;
+    uint64_t last_sequence = 0;
+
+    while (atomic_load_explicit(&writer->running, memory_order_relaxed)) {
+        Frame* frame = frame_ring_wait_latest(writer->ring, last_sequence, FRAME_CAPTURE_WAIT_MS);
+        if (frame == NULL) {
+            continue;
+        }
+        last_sequence = frame->sequence;
+        if (!stage_rate_due(&writer->rate, frame->timestamp)) {
+            frame_ring_release(frame);
+            continue;
+        }
+
+        size_t bound = sizeof(FrameCaptureRecord) + (size_t)LZ4_compressBound((int)frame->data_size);
+        if (prepareCurrent(writer, bound) != 0) {
+            frame_ring_release(frame);
+            writer->dropped++;
+            continue;
+        }
+
+        // Compress straight from the ring slot into the chunk
+        FrameCaptureBuffer* buffer = &writer->buffers[writer->current];
+        FrameCaptureRecord record = {
+            .sequence = frame->sequence,
+            .timestamp = frame->timestamp,
+            .frametype = (uint32_t)frame->frametype,
+            .raw_size = (uint32_t)frame->data_size,
+        };
+        frame_get_dimensions(frame->frametype, &frame->framedesc, &record.width, &record.height, &record.stride);
+        uint8_t* block = buffer->data + buffer->used + sizeof(record);
+        int compressed = LZ4_compress_default((const char*)frame->mapped_data, (char*)block, (int)frame->data_size,
+                                              (int)(buffer->capacity - buffer->used - sizeof(record)));
+        frame_ring_release(frame);
+        if (compressed <= 0) {
+            writer->dropped++;
+            continue;
+        }
+        record.compressed_size = (uint32_t)compressed;
+        memcpy(buffer->data + buffer->used, &record, sizeof(record));
+
+        pthread_mutex_lock(&writer->lock);
+        buffer->used += sizeof(record) + (size_t)compressed;
+        buffer->frame_count++;
+        writer->frames++;
+        writer->raw_bytes += record.raw_size;
+        if (buffer->used >= FRAME_CAPTURE_CHUNK_TARGET) {
+            submitCurrent(writer);
+        }
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    return NULL;
+}
+
+static void* writerThread(void* arg)
+{
+    FrameCaptureWriter* writer = (FrameCaptureWriter*)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        if (writer->full_count == 0) {
+            if (!writer->writer_running) {
+                break;
+            }
+            pthread_cond_wait(&writer->changed, &writer->lock);
+            continue;
+        }
+        int index = writer->full_list[0];
+        writer->full_count--;
+        memmove(&writer->full_list[0], &writer->full_list[1], writer->full_count * sizeof(writer->full_list[0]));
+        pthread_mutex_unlock(&writer->lock);
+
+        FrameCaptureBuffer* buffer = &writer->buffers[index];
+        if (writeAll(writer->fd, buffer->data, buffer->used) != 0) {
+            perror("write");
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->written_bytes += buffer->used;
+        resetBuffer(buffer);
+        writer->free_list[writer->free_count++] = index;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+int frame_capture_start(FrameCaptureWriter* writer, const char* path, FrameRing* ring, const StageRate* rate)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->ring = ring;
+    if (rate) {
+        writer->rate = *rate;
+    } else {
+        stage_rate_init(&writer->rate);
+    }
+    writer->current = -1;
+    writer->alignment = (size_t)sysconf(_SC_PAGESIZE);
+    if (writer->alignment < FRAME_CAPTURE_MIN_ALIGNMENT) {
+        writer->alignment = FRAME_CAPTURE_MIN_ALIGNMENT;
+    }
+    for (int i = 0; i < FRAME_CAPTURE_NUM_CHUNKS; i++) {
+        writer->free_list[writer->free_count++] = i;
+    }
+
+    writer->fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (writer->fd == -1) {
+        printf("Failed to create capture file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // The header occupies a whole alignment block so the first chunk is aligned
+    void* block = NULL;
+    if (posix_memalign(&block, writer->alignment, writer->alignment) != 0) {
+        close(writer->fd);
+        return -1;
+    }
+    memset(block, 0, writer->alignment);
+    FrameCaptureHeader header = {
+        .magic = FRAME_CAPTURE_MAGIC,
+        .version = FRAME_CAPTURE_VERSION,
+        .alignment = (uint32_t)writer->alignment,
+    };
+    memcpy(block, &header, sizeof(header));
+    int err = writeAll(writer->fd, block, writer->alignment);
+    free(block);
+    if (err != 0) {
+        printf("Failed to write capture header: %s\n", strerror(errno));
+        close(writer->fd);
+        return -1;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    atomic_init(&writer->running, true);
+    writer->writer_running = true;
+
+    if (pthread_create(&writer->writer_thread, NULL, writerThread, writer) != 0) {
+        printf("Failed to create capture writer thread\n");
+        close(writer->fd);
+        return -1;
+    }
+    if (pthread_create(&writer->compressor_thread, NULL, compressorThread, writer) != 0) {
+        printf("Failed to create capture compressor thread\n");
+        pthread_mutex_lock(&writer->lock);
+        writer->writer_running = false;
+        pthread_cond_broadcast(&writer->changed);
+        pthread_mutex_unlock(&writer->lock);
+        pthread_join(writer->writer_thread, NULL);
+        close(writer->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+void frame_capture_stop(FrameCaptureWriter* writer)
+{
+    atomic_store(&writer->running, false);
+    pthread_join(writer->compressor_thread, NULL);
+
+    pthread_mutex_lock(&writer->lock);
+    if ((writer->current != -1) && (writer->buffers[writer->current].frame_count > 0)) {
+        submitCurrent(writer);
+    }
+    writer->writer_running = false;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->writer_thread, NULL);
+
+    printf("Captured %llu frames: %llu bytes raw, %llu bytes written, %llu dropped\n",
+           (unsigned long long)writer->frames, (unsigned long long)writer->raw_bytes,
+           (unsigned long long)writer->written_bytes, (unsigned long long)writer->dropped);
+
+    for (int i = 0; i < FRAME_CAPTURE_NUM_CHUNKS; i++) {
+        free(writer->buffers[i].data);
+        writer->buffers[i].data = NULL;
+    }
+    pthread_cond_destroy(&writer->changed);
+    pthread_mutex_destroy(&writer->lock);
+    close(writer->fd);
+    writer->fd = -1;
+}
+
+int frame_capture_open(FrameCaptureReader* reader, const char* path)
+{
+    FrameCaptureHeader header;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd == -1) {
+        printf("Failed to open capture file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if ((read(reader->fd, &header, sizeof(header)) != sizeof(header))
+        || (header.magic != FRAME_CAPTURE_MAGIC) || (header.version != FRAME_CAPTURE_VERSION)
+        || (header.alignment < sizeof(header))) {
+        printf("%s is not a capture file\n", path);
+        close(reader->fd);
+        return -1;
+    }
+    reader->alignment = header.alignment;
+    if (lseek(reader->fd, (off_t)reader->alignment, SEEK_SET) == -1) {
+        close(reader->fd);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Reads the next chunk into the reader's chunk buffer
+ *
+ * @return 1 on success, 0 at end of file, -1 on error
+ */
+static int readChunk(FrameCaptureReader* reader)
+{
+    FrameCaptureChunk chunk;
+
+    ssize_t got = read(reader->fd, &chunk, sizeof(chunk));
+    if (got == 0) {
+        return 0;
+    }
+    if ((got != sizeof(chunk)) || (chunk.magic != FRAME_CAPTURE_CHUNK_MAGIC)) {
+        return -1;
+    }
+
+    // Read the rest of the chunk, including its padding, in one go
+    size_t total = alignUp(sizeof(chunk) + chunk.payload_size, reader->alignment) - sizeof(chunk);
+    if (total > reader->chunk_capacity) {
+        uint8_t* data = realloc(reader->chunk, total);
+        if (data == NULL) {
+            return -1;
+        }
+        reader->chunk = data;
+        reader->chunk_capacity = total;
+    }
+    size_t done = 0;
+    while (done < total) {
+        got = read(reader->fd, reader->chunk + done, total - done);
+        if (got <= 0) {
+            return -1;
+        }
+        done += (size_t)got;
+    }
+
+    reader->chunk_used = chunk.payload_size;
+    reader->chunk_offset = 0;
+    reader->chunk_frames_left = chunk.frame_count;
+    return 1;
+}
+
+int frame_capture_read(FrameCaptureReader* reader, FrameCaptureRecord* record, uint8_t* data, size_t capacity)
+{
+    while (reader->chunk_frames_left == 0) {
+        int err = readChunk(reader);
+        if (err <= 0) {
+            return err;
+        }
+    }
+
+    if (reader->chunk_offset + sizeof(*record) > reader->chunk_used) {
+        return -1;
+    }
+    memcpy(record, reader->chunk + reader->chunk_offset, sizeof(*record));
+    if (reader->chunk_offset + sizeof(*record) + record->compressed_size > reader->chunk_used) {
+        return -1;
+    }
+    if (capacity < record->raw_size) {
+        // Leave the record in place so the caller can retry with a bigger buffer
+        return FRAME_CAPTURE_TOO_SMALL;
+    }
+
+    const char* block = (const char*)reader->chunk + reader->chunk_offset + sizeof(*record);
+    int size = LZ4_decompress_safe(block, (char*)data, (int)record->compressed_size, (int)capacity);
+    if (size != (int)record->raw_size) {
+        return -1;
+    }
+    reader->chunk_offset += sizeof(*record) + record->compressed_size;
+    reader->chunk_frames_left--;
+
+    return 1;
+}
+
+void frame_capture_close(FrameCaptureReader* reader)
+{
+    free(reader->chunk);
+    reader->chunk = NULL;
+    if (reader->fd != -1) {
+        close(reader->fd);
+        reader->fd = -1;
+    }
+}
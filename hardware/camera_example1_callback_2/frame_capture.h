@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_CAPTURE_H
+#define FRAME_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <camera/camera_api.h>
+#include "frame_ring.h"
+#include "stage_rate.h"
+
+#define FRAME_CAPTURE_MAGIC         (0x5a504143u)
+#define FRAME_CAPTURE_CHUNK_MAGIC   (0x4b4e4843u)
+#define FRAME_CAPTURE_VERSION       (1)
+
+/**
+ * @brief Returned by @c frame_capture_read when the frame does not fit into the buffer
+ */
+#define FRAME_CAPTURE_TOO_SMALL     (-2)
+
+/**
+ * @brief Number of chunk buffers shared by the compressor and the writer thread
+ */
+#define FRAME_CAPTURE_NUM_CHUNKS (3)
+
+/**
+ * @brief File header of a capture file
+ *
+ * It is followed by chunks, each starting on a @c alignment boundary with a
+ * @c FrameCaptureChunk header and holding @c frame_count frame records. Each
+ * record is a @c FrameCaptureRecord followed by its LZ4 block.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t alignment;
+    uint32_t reserved;
+} FrameCaptureHeader;
+
+/**
+ * @brief Header of one chunk of frame records
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t frame_count;
+    uint64_t payload_size;
+} FrameCaptureChunk;
+
+/**
+ * @brief Per-frame metadata stored in front of each compressed frame
+ */
+typedef struct {
+    uint64_t sequence;
+    int64_t timestamp;
+    uint32_t frametype;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+} FrameCaptureRecord;
+
+/**
+ * @brief Buffer holding one chunk while it is filled or written
+ */
+typedef struct {
+    uint8_t* data;
+    size_t capacity;
+    size_t used;
+    uint32_t frame_count;
+} FrameCaptureBuffer;
+
+/**
+ * @brief Capture writer
+ *
+ * A compressor thread takes frames from the ring and compresses them straight
+ * from the ring slot into the current chunk. Full chunks are queued to a
+ * writer thread that issues one large aligned write per chunk.
+ */
+typedef struct {
+    int fd;
+    size_t alignment;
+    FrameRing* ring;
+    StageRate rate;
+    FrameCaptureBuffer buffers[FRAME_CAPTURE_NUM_CHUNKS];
+    int free_list[FRAME_CAPTURE_NUM_CHUNKS];
+    int free_count;
+    int full_list[FRAME_CAPTURE_NUM_CHUNKS];
+    int full_count;
+    int current;
+    atomic_bool running;
+    bool writer_running;
+    pthread_t compressor_thread;
+    pthread_t writer_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint64_t frames;
+    uint64_t raw_bytes;
+    uint64_t written_bytes;
+    uint64_t dropped;
+} FrameCaptureWriter;
+
+/**
+ * @brief Capture reader
+ */
+typedef struct {
+    int fd;
+    size_t alignment;
+    uint8_t* chunk;
+    size_t chunk_capacity;
+    size_t chunk_used;
+    size_t chunk_offset;
+    uint32_t chunk_frames_left;
+} FrameCaptureReader;
+
+/**
+ * @brief Creates a capture file and starts recording new ring frames into it
+ *
+ * @param writer Writer state
+ * @param path Capture file to create
+ * @param ring Ring to take frames from
+ * @param rate Rate at which frames are captured, or NULL for every frame
+ * @return 0 on success, -1 on failure
+ */
+int frame_capture_start(FrameCaptureWriter* writer, const char* path, FrameRing* ring, const StageRate* rate);
+
+/**
+ * @brief Stops the threads, writes the last partial chunk and closes the file
+ */
+void frame_capture_stop(FrameCaptureWriter* writer);
+
+/**
+ * @brief Opens a capture file for reading
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_capture_open(FrameCaptureReader* reader, const char* path);
+
+/**
+ * @brief Reads and decompresses the next frame
+ *
+ * @param reader Capture reader
+ * @param record Receives the frame metadata
+ * @param data Buffer the frame is decompressed into
+ * @param capacity Size of @c data; must be at least @c record->raw_size
+ * @return 1 if a frame was read, 0 at end of file, @c FRAME_CAPTURE_TOO_SMALL if @c data is
+ *         too small (@c record->raw_size then holds the required size), -1 on error
+ */
+int frame_capture_read(FrameCaptureReader* reader, FrameCaptureRecord* record, uint8_t* data, size_t capacity);
+
+/**
+ * @brief Closes a capture reader
+ */
+void frame_capture_close(FrameCaptureReader* reader);
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include "frame_histogram.h"
+#include "pixel_layout.h"
+
+/**
+ * @brief Counts the sampled units of some rows of one layout; unrolled by four units
+ */
+PIXEL_KERNEL_INLINE void countLayout(uint32_t bins[HISTOGRAM_CHANNELS][HISTOGRAM_BINS], const uint8_t* data,
+                                     uint32_t width, uint32_t height, uint32_t stride, uint32_t first_row,
+                                     uint32_t row_count, uint32_t step, bool chromaShared, uint32_t a, uint32_t b,
+                                     uint32_t c, uint32_t d)
+{
+    uint32_t units = pixel_layout_units(chromaShared, width);
+
+    for (uint32_t i = 0; i < row_count; i++) {
+        uint32_t y = first_row + i * step;
+        if (y >= height) {
+            break;
+        }
+        const uint8_t* line = data + (size_t)y * stride;
+        uint32_t x = 0;
+
+#define COUNT_UNIT(offset)                                                    \
+        do {                                                                  \
+            const uint8_t* unit = line + (size_t)(offset) * PIXEL_UNIT_BYTES; \
+            bins[0][unit[a]]++;                                               \
+            if (chromaShared) {                                               \
+                bins[0][unit[b]]++;                                           \
+                bins[1][unit[c]]++;                                           \
+                bins[2][unit[d]]++;                                           \
+            } else {                                                          \
+                bins[1][unit[b]]++;                                           \
+                bins[2][unit[c]]++;                                           \
+            }                                                                 \
+        } while (0)
+
+        for (; x + 3 * step < units; x += 4 * step) {
+            COUNT_UNIT(x);
+            COUNT_UNIT(x + step);
+            COUNT_UNIT(x + 2 * step);
+            COUNT_UNIT(x + 3 * step);
+        }
+        for (; x < units; x += step) {
+            COUNT_UNIT(x);
+        }
+#undef COUNT_UNIT
+    }
+}
+
+#define DEFINE_KERNEL(name, frametype, chromaShared, a, b, c, d)                                                 \
+    static void count##name(uint32_t bins[HISTOGRAM_CHANNELS][HISTOGRAM_BINS], const uint8_t* data,            \
+                            uint32_t width, uint32_t height, uint32_t stride, uint32_t first_row,              \
+                            uint32_t row_count, uint32_t step)                                                 \
+    {                                                                                                           \
+        countLayout(bins, data, width, height, stride, first_row, row_count, step, chromaShared, a, b, c, d);  \
+    }
+PIXEL_LAYOUTS(DEFINE_KERNEL)
+#undef DEFINE_KERNEL
+
+FrameHistogramKernel frame_histogram_kernel(camera_frametype_t frametype)
+{
+#define KERNEL_CASE(name, layoutFrametype, chromaShared, a, b, c, d) \
+    case layoutFrametype:                                           \
+        return count##name;
+
+    switch (frametype) {
+    PIXEL_LAYOUTS(KERNEL_CASE)
+    default:
+        return NULL;
+    }
+#undef KERNEL_CASE
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_HISTOGRAM_H
+#define FRAME_HISTOGRAM_H
+
+#include <stdint.h>
+#include <camera/camera_api.h>
+
+/**
+ * @brief Number of histogram channels: R, G, B for RGB frames, Y, Cb, Cr for YUV frames
+ */
+#define HISTOGRAM_CHANNELS (3)
+
+/**
+ * @brief Number of bins per channel, one per 8-bit value
+ */
+#define HISTOGRAM_BINS (256)
+
+/**
+ * @brief Per-channel histograms of one frame
+ *
+ * Only every @c step-th row and column (macropixel for YUV) is counted;
+ * @c samples holds the number of values counted per channel. @c timestamp is
+ * the frame timestamp, 0 before the first histogram.
+ */
+typedef struct {
+    int64_t timestamp;
+    uint32_t step;
+    uint32_t samples[HISTOGRAM_CHANNELS];
+    uint32_t bins[HISTOGRAM_CHANNELS][HISTOGRAM_BINS];
+} FrameHistogram;
+
+/**
+ * @brief Adds the values of some rows of a frame to per-channel bins
+ *
+ * Counts rows @c first_row, @c first_row + @c step, ... for @c row_count
+ * rows, and every @c step-th pixel of each. Several callers can work on
+ * disjoint rows of the same frame as long as each has its own @c bins.
+ */
+typedef void (*FrameHistogramKernel)(uint32_t bins[HISTOGRAM_CHANNELS][HISTOGRAM_BINS], const uint8_t* data,
+                                     uint32_t width, uint32_t height, uint32_t stride, uint32_t first_row,
+                                     uint32_t row_count, uint32_t step);
+
+/**
+ * @brief Picks the histogram kernel specialised for a frametype, once per stream
+ *
+ * @return Kernel, or NULL if the frametype is not supported
+ */
+FrameHistogramKernel frame_histogram_kernel(camera_frametype_t frametype);
+
+#endif
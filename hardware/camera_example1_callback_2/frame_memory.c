@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(__QNXNTO__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "frame_memory.h"
+
+/**
+ * @brief Granularity large-page mappings are rounded up to
+ */
+#define LARGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+/**
+ * @brief Set once a lock failure has been reported, so it is only reported once
+ */
+static atomic_bool lockWarned;
+
+static size_t roundSize(size_t size, unsigned flags)
+{
+    if (flags & FRAME_MEMORY_LARGE_PAGES) {
+        return (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+    }
+    return size;
+}
+
+/**
+ * @brief Applies the large page hint and faults in and locks the mapping as requested
+ */
+static void prepareMapping(void* memory, size_t size, unsigned flags)
+{
+#if !defined(__QNXNTO__) && defined(MADV_HUGEPAGE)
+    if (flags & FRAME_MEMORY_LARGE_PAGES) {
+        (void)madvise(memory, size, MADV_HUGEPAGE);
+    }
+#endif
+
+    if (flags & FRAME_MEMORY_LOCKED) {
+        // Touch every page so it is backed now rather than on the first frame
+        long page_size = sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < size; offset += (size_t)((page_size > 0) ? page_size : 4096)) {
+            ((volatile uint8_t*)memory)[offset] = 0;
+        }
+        if ((mlock(memory, size) != 0) && !atomic_exchange(&lockWarned, true)) {
+            printf("Failed to lock frame memory: %s\n", strerror(errno));
+        }
+    }
+}
+
+void* frame_memory_map_shared(int fd, size_t* size, unsigned flags)
+{
+    size_t length = roundSize(*size, flags);
+    bool sized = false;
+
+#ifdef __QNXNTO__
+    // Physically contiguous backing lets procnto map the object with large pages
+    if ((flags & FRAME_MEMORY_LARGE_PAGES) && (shm_ctl(fd, SHMCTL_ANON | SHMCTL_PHYS, 0, length) == 0)) {
+        sized = true;
+    }
+#endif
+    if (!sized && (ftruncate(fd, length) == -1)) {
+        return NULL;
+    }
+
+    void* memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    prepareMapping(memory, length, flags);
+    *size = length;
+    return memory;
+}
+
+void* frame_memory_alloc(size_t* size, unsigned flags)
+{
+    size_t length = roundSize(*size, flags);
+    void* memory = MAP_FAILED;
+
+    if (flags & FRAME_MEMORY_LARGE_PAGES) {
+#ifdef __QNXNTO__
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_PHYS, NOFD, 0);
+#elif defined(MAP_HUGETLB)
+        // Only succeeds if huge pages have been reserved; THP is requested otherwise
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    }
+    if (memory == MAP_FAILED) {
+        memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    }
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    prepareMapping(memory, length, flags);
+    *size = length;
+    return memory;
+}
+
+void frame_memory_free(void* memory, size_t size)
+{
+    if (memory) {
+        munmap(memory, size);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_MEMORY_H
+#define FRAME_MEMORY_H
+
+#include <stddef.h>
+
+/**
+ * @brief Back the memory with large pages where the system provides them
+ *
+ * On QNX the memory is allocated physically contiguous so procnto can map it
+ * with its largest page sizes; on Linux explicit huge pages are tried first
+ * and transparent huge pages requested otherwise.
+ */
+#define FRAME_MEMORY_LARGE_PAGES (1u << 0)
+
+/**
+ * @brief Fault the memory in up front and lock it so capture never takes a first-touch fault
+ */
+#define FRAME_MEMORY_LOCKED (1u << 1)
+
+/**
+ * @brief Sizes a shared memory object and maps it read-write
+ *
+ * @param fd Shared memory object opened read-write
+ * @param size In: bytes needed. Out: bytes mapped, which may be rounded up to the large page size
+ * @param flags Combination of @c FRAME_MEMORY_LARGE_PAGES and @c FRAME_MEMORY_LOCKED
+ * @return The mapping, or NULL on failure
+ */
+void* frame_memory_map_shared(int fd, size_t* size, unsigned flags);
+
+/**
+ * @brief Maps private memory for frame-sized scratch buffers
+ *
+ * @param size In: bytes needed. Out: bytes mapped
+ * @param flags Combination of @c FRAME_MEMORY_LARGE_PAGES and @c FRAME_MEMORY_LOCKED
+ * @return The mapping, or NULL on failure
+ */
+void* frame_memory_alloc(size_t* size, unsigned flags);
+
+/**
+ * @brief Unmaps memory returned by @c frame_memory_map_shared or @c frame_memory_alloc
+ */
+void frame_memory_free(void* memory, size_t size);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "frame_ring.h"
+
+/**
+ * @brief Makes sure a slot's shared memory object can hold @c size bytes
+ *
+ * Slots stay mapped between frames and are only remapped when they need to grow.
+ * Every (re)map is an allocation of the arena, so one after warm-up is reported.
+ */
+static int reserveSlot(FrameRing* ring, Frame* slot, size_t size)
+{
+    if (slot->mapped_data && (slot->mapped_size >= size)) {
+        return 0;
+    }
+
+    frame_arena_count_allocation(ring->arena);
+    int fd = shm_open(slot->shm_name, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) {
+        return -1;
+    }
+    size_t mapped_size = size;
+    uint8_t* mapped_data = frame_memory_map_shared(fd, &mapped_size, ring->arena->memory_flags);
+    close(fd);
+    if (mapped_data == NULL) {
+        return -1;
+    }
+
+    frame_memory_free(slot->mapped_data, slot->mapped_size);
+    slot->mapped_data = mapped_data;
+    slot->mapped_size = mapped_size;
+    return 0;
+}
+
+/**
+ * @brief Picks the oldest slot that is neither held by a reader nor the latest frame
+ *
+ * Must be called with the ring lock held.
+ *
+ * @return Slot index, or -1 if every slot is busy
+ */
+static int findFreeSlot(FrameRing* ring)
+{
+    int found = -1;
+
+    for (int i = 0; i < MAX_FRAMES; i++) {
+        Frame* slot = &ring->slots[i];
+        if ((i == ring->latest_index) || (atomic_load_explicit(&slot->refcount, memory_order_acquire) != 0)) {
+            continue;
+        }
+        if ((found == -1) || (slot->sequence < ring->slots[found].sequence)) {
+            found = i;
+        }
+    }
+
+    return found;
+}
+
+void frame_get_dimensions(camera_frametype_t frametype, const camera_framedesc_t* framedesc,
+                          uint32_t* width, uint32_t* height, uint32_t* stride)
+{
+    switch (frametype) {
+    case CAMERA_FRAMETYPE_RGB8888:
+        *width = framedesc->rgb8888.width;
+        *height = framedesc->rgb8888.height;
+        *stride = framedesc->rgb8888.stride;
+        break;
+    case CAMERA_FRAMETYPE_BGR8888:
+        *width = framedesc->bgr8888.width;
+        *height = framedesc->bgr8888.height;
+        *stride = framedesc->bgr8888.stride;
+        break;
+    case CAMERA_FRAMETYPE_YCBYCR:
+        *width = framedesc->ycbycr.width;
+        *height = framedesc->ycbycr.height;
+        *stride = framedesc->ycbycr.stride;
+        break;
+    case CAMERA_FRAMETYPE_CBYCRY:
+        *width = framedesc->cbycry.width;
+        *height = framedesc->cbycry.height;
+        *stride = framedesc->cbycry.stride;
+        break;
+    default:
+        *width = 0;
+        *height = 0;
+        *stride = 0;
+        break;
+    }
+}
+
+void frame_set_dimensions(camera_frametype_t frametype, camera_framedesc_t* framedesc,
+                          uint32_t width, uint32_t height, uint32_t stride)
+{
+    switch (frametype) {
+    case CAMERA_FRAMETYPE_RGB8888:
+        framedesc->rgb8888.width = width;
+        framedesc->rgb8888.height = height;
+        framedesc->rgb8888.stride = stride;
+        break;
+    case CAMERA_FRAMETYPE_BGR8888:
+        framedesc->bgr8888.width = width;
+        framedesc->bgr8888.height = height;
+        framedesc->bgr8888.stride = stride;
+        break;
+    case CAMERA_FRAMETYPE_YCBYCR:
+        framedesc->ycbycr.width = width;
+        framedesc->ycbycr.height = height;
+        framedesc->ycbycr.stride = stride;
+        break;
+    case CAMERA_FRAMETYPE_CBYCRY:
+        framedesc->cbycry.width = width;
+        framedesc->cbycry.height = height;
+        framedesc->cbycry.stride = stride;
+        break;
+    default:
+        break;
+    }
+}
+
+int frame_ring_init(FrameRing* ring, const char* shm_prefix, FrameArena* arena)
+{
+    pthread_condattr_t condAttr;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->latest_index = -1;
+    ring->next_sequence = 1;
+    ring->arena = arena;
+    for (int i = 0; i < MAX_FRAMES; i++) {
+        snprintf(ring->slots[i].shm_name, sizeof(ring->slots[i].shm_name), "%s%d", shm_prefix, i);
+        atomic_init(&ring->slots[i].refcount, 0);
+    }
+
+    if (pthread_mutex_init(&ring->lock, NULL) != 0) {
+        return -1;
+    }
+    (void)pthread_condattr_init(&condAttr);
+    (void)pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&ring->frame_ready, &condAttr) != 0) {
+        (void)pthread_condattr_destroy(&condAttr);
+        (void)pthread_mutex_destroy(&ring->lock);
+        return -1;
+    }
+    (void)pthread_condattr_destroy(&condAttr);
+
+    return 0;
+}
+
+int frame_ring_reserve(FrameRing* ring, size_t size)
+{
+    for (int i = 0; i < MAX_FRAMES; i++) {
+        if (reserveSlot(ring, &ring->slots[i], size) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void frame_ring_destroy(FrameRing* ring)
+{
+    for (int i = 0; i < MAX_FRAMES; i++) {
+        Frame* slot = &ring->slots[i];
+        if (slot->mapped_data) {
+            frame_memory_free(slot->mapped_data, slot->mapped_size);
+            shm_unlink(slot->shm_name);
+            slot->mapped_data = NULL;
+        }
+    }
+    (void)pthread_cond_destroy(&ring->frame_ready);
+    (void)pthread_mutex_destroy(&ring->lock);
+}
+
+uint64_t frame_ring_push(FrameRing* ring, const camera_buffer_t* buffer, size_t size)
+{
+    pthread_mutex_lock(&ring->lock);
+    int index = findFreeSlot(ring);
+    if (index == -1) {
+        ring->dropped++;
+        pthread_mutex_unlock(&ring->lock);
+        return 0;
+    }
+    // Sequence 0 marks the slot as being filled so history readers skip it
+    Frame* slot = &ring->slots[index];
+    slot->sequence = 0;
+    bool first = (ring->latest_index == -1);
+    pthread_mutex_unlock(&ring->lock);
+
+    // The slot is neither the latest frame nor held by anyone, and readers
+    // skip it while its sequence is 0, so it can be filled without the lock.
+    // Before the first frame nobody holds any slot, so all of them are sized
+    // for it at once rather than one by one after warm-up.
+    int reserved = first ? frame_ring_reserve(ring, size) : reserveSlot(ring, slot, size);
+    if (reserved != 0) {
+        pthread_mutex_lock(&ring->lock);
+        ring->dropped++;
+        pthread_mutex_unlock(&ring->lock);
+        return 0;
+    }
+    memcpy(slot->mapped_data, buffer->framebuf, size);
+    slot->frametype = buffer->frametype;
+    slot->framedesc = buffer->framedesc;
+    slot->data_size = size;
+    slot->timestamp = buffer->frametimestamp;
+
+    pthread_mutex_lock(&ring->lock);
+    slot->sequence = ring->next_sequence++;
+    ring->latest_index = index;
+    uint64_t sequence = slot->sequence;
+    pthread_cond_broadcast(&ring->frame_ready);
+    pthread_mutex_unlock(&ring->lock);
+
+    return sequence;
+}
+
+Frame* frame_ring_acquire_latest(FrameRing* ring)
+{
+    Frame* frame = NULL;
+
+    pthread_mutex_lock(&ring->lock);
+    if (ring->latest_index != -1) {
+        frame = &ring->slots[ring->latest_index];
+        atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return frame;
+}
+
+Frame* frame_ring_wait_latest(FrameRing* ring, uint64_t last_sequence, int timeout_ms)
+{
+    struct timespec deadline;
+    Frame* frame = NULL;
+
+    if (timeout_ms >= 0) {
+        (void)clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    while (!ring->stopping) {
+        if ((ring->latest_index != -1) && (ring->slots[ring->latest_index].sequence != last_sequence)) {
+            frame = &ring->slots[ring->latest_index];
+            atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+            break;
+        }
+        int err;
+        if (timeout_ms >= 0) {
+            err = pthread_cond_timedwait(&ring->frame_ready, &ring->lock, &deadline);
+        } else {
+            err = pthread_cond_wait(&ring->frame_ready, &ring->lock);
+        }
+        if (err != 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return frame;
+}
+
+int frame_ring_acquire_since(FrameRing* ring, uint64_t after_sequence, Frame* frames[MAX_FRAMES])
+{
+    int count = 0;
+
+    pthread_mutex_lock(&ring->lock);
+    for (int i = 0; i < MAX_FRAMES; i++) {
+        Frame* slot = &ring->slots[i];
+        if ((slot->sequence == 0) || (slot->sequence <= after_sequence)) {
+            continue;
+        }
+        atomic_fetch_add_explicit(&slot->refcount, 1, memory_order_relaxed);
+
+        // Insert in sequence order
+        int j = count++;
+        while ((j > 0) && (frames[j - 1]->sequence > slot->sequence)) {
+            frames[j] = frames[j - 1];
+            j--;
+        }
+        frames[j] = slot;
+    }
+    pthread_mutex_unlock(&ring->lock);
+
+    return count;
+}
+
+void frame_ring_release(Frame* frame)
+{
+    if (frame) {
+        atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_release);
+    }
+}
+
+void frame_ring_stop(FrameRing* ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    ring->stopping = true;
+    pthread_cond_broadcast(&ring->frame_ready);
+    pthread_mutex_unlock(&ring->lock);
+}
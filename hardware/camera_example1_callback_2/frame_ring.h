@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <camera/camera_api.h>
+#include "frame_arena.h"
+
+/**
+ * @brief Number of slots in the frame ring
+ */
+#define MAX_FRAMES 5
+
+/**
+ * @brief One slot of the frame ring, backed by its own shared memory object
+ *
+ * A slot returned by @c frame_ring_acquire_latest or @c frame_ring_wait_latest
+ * stays valid and unmodified until it is handed back with @c frame_ring_release.
+ */
+typedef struct {
+    camera_frametype_t frametype;
+    camera_framedesc_t framedesc;
+    char shm_name[64];
+    uint8_t* mapped_data;
+    size_t data_size;
+    size_t mapped_size;
+    uint64_t sequence;
+    int64_t timestamp;
+    atomic_uint refcount;
+} Frame;
+
+/**
+ * @brief Ring of the most recent camera frames
+ *
+ * The writer never blocks on readers: slots that are still held are skipped,
+ * and the frame is dropped if every slot is busy.
+ */
+typedef struct {
+    Frame slots[MAX_FRAMES];
+    int latest_index;
+    uint64_t next_sequence;
+    uint64_t dropped;
+    FrameArena* arena;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t frame_ready;
+} FrameRing;
+
+/**
+ * @brief Extracts the dimensions of a frame of a supported frametype
+ *
+ * All outputs are set to 0 for unsupported frametypes.
+ */
+void frame_get_dimensions(camera_frametype_t frametype, const camera_framedesc_t* framedesc,
+                          uint32_t* width, uint32_t* height, uint32_t* stride);
+
+/**
+ * @brief Fills in the frame descriptor of a supported frametype
+ */
+void frame_set_dimensions(camera_frametype_t frametype, camera_framedesc_t* framedesc,
+                          uint32_t width, uint32_t height, uint32_t stride);
+
+/**
+ * @brief Initialises an empty ring whose slots are named @c <shm_prefix><index>
+ *
+ * @param ring Frame ring
+ * @param shm_prefix Prefix of the slots' shared memory names
+ * @param arena Arena of the pipeline; slots are mapped with its memory flags, and every
+ *              slot mapping counts as one of its allocations
+ * @return 0 on success, -1 on failure
+ */
+int frame_ring_init(FrameRing* ring, const char* shm_prefix, FrameArena* arena);
+
+/**
+ * @brief Maps every slot for frames of up to @c size bytes ahead of the first frame
+ *
+ * @return 0 on success, -1 on failure
+ */
+int frame_ring_reserve(FrameRing* ring, size_t size);
+
+/**
+ * @brief Unmaps and unlinks every slot; no handles may be outstanding
+ */
+void frame_ring_destroy(FrameRing* ring);
+
+/**
+ * @brief Copies a camera buffer into the oldest free slot and makes it the latest frame
+ *
+ * @param ring Frame ring
+ * @param buffer Camera buffer to copy
+ * @param size Size of the frame data in bytes
+ * @return Sequence number of the stored frame, or 0 if the frame was dropped
+ */
+uint64_t frame_ring_push(FrameRing* ring, const camera_buffer_t* buffer, size_t size);
+
+/**
+ * @brief Takes a reference on the most recent frame
+ *
+ * @return The frame, or NULL if the ring is empty
+ */
+Frame* frame_ring_acquire_latest(FrameRing* ring);
+
+/**
+ * @brief Blocks until a frame newer than @c last_sequence is available and takes a reference on it
+ *
+ * @param ring Frame ring
+ * @param last_sequence Sequence number of the last frame the caller has seen (0 for none)
+ * @param timeout_ms Maximum time to wait in milliseconds; negative waits forever
+ * @return The frame, or NULL on timeout or once @c frame_ring_stop has been called
+ */
+Frame* frame_ring_wait_latest(FrameRing* ring, uint64_t last_sequence, int timeout_ms);
+
+/**
+ * @brief Takes references on every stored frame newer than @c after_sequence, oldest first
+ *
+ * Used to pick up the history still held in the ring, e.g. the frames
+ * leading up to a trigger.
+ *
+ * @param ring Frame ring
+ * @param after_sequence Only frames with a higher sequence number are returned
+ * @param frames Receives up to @c MAX_FRAMES frames; each must be released
+ * @return Number of frames returned
+ */
+int frame_ring_acquire_since(FrameRing* ring, uint64_t after_sequence, Frame* frames[MAX_FRAMES]);
+
+/**
+ * @brief Drops a reference taken by @c frame_ring_acquire_latest or @c frame_ring_wait_latest
+ */
+void frame_ring_release(Frame* frame);
+
+/**
+ * @brief Wakes every waiter and makes further waits return NULL immediately
+ */
+void frame_ring_stop(FrameRing* ring);
+
+#endif
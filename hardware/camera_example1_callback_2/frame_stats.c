@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "frame_stats.h"
+#include "frame_ring.h"
+#include "pixel_layout.h"
+
+/**
+ * @brief Running sums of one channel
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t sum_squares;
+} ChannelSums;
+
+typedef void (*SumFunction)(ChannelSums sums[FRAME_STATS_CHANNELS], const uint8_t* data, uint32_t width,
+                            uint32_t height, uint32_t stride, uint32_t step);
+
+struct FrameStatsKernel {
+    camera_frametype_t frametype;
+    bool chroma_shared;
+    SumFunction sum;
+};
+
+/**
+ * @brief Sums the sampled units of a frame of one layout
+ *
+ * Every instance gets its layout as constants, so the unrolled inner loop is
+ * plain loads and adds. Row sums are kept in 32 bits, which holds even the
+ * squares of a 16k pixel row.
+ */
+PIXEL_KERNEL_INLINE void sumLayout(ChannelSums sums[FRAME_STATS_CHANNELS], const uint8_t* data, uint32_t width,
+                                   uint32_t height, uint32_t stride, uint32_t step, bool chromaShared, uint32_t a,
+                                   uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t units = pixel_layout_units(chromaShared, width);
+    uint32_t first = step / 2;
+
+    // Sample the middle of each step x step block rather than its corner
+    for (uint32_t y = first; y < height; y += step) {
+        const uint8_t* line = data + (size_t)y * stride;
+        uint32_t sum0 = 0, sum1 = 0, sum2 = 0;
+        uint32_t squares0 = 0, squares1 = 0, squares2 = 0;
+        uint32_t count = 0;
+        uint32_t x = first;
+
+#define SUM_UNIT(offset)                                                      \
+        do {                                                                  \
+            const uint8_t* unit = line + (size_t)(offset) * PIXEL_UNIT_BYTES; \
+            uint32_t v0 = unit[a], v1 = unit[b], v2 = unit[c];                \
+            if (chromaShared) {                                               \
+                uint32_t v3 = unit[d];                                        \
+                sum0 += v0 + v1;                                              \
+                squares0 += v0 * v0 + v1 * v1;                                \
+                sum1 += v2;                                                   \
+                squares1 += v2 * v2;                                          \
+                sum2 += v3;                                                   \
+                squares2 += v3 * v3;                                          \
+            } else {                                                          \
+                sum0 += v0;                                                   \
+                squares0 += v0 * v0;                                          \
+                sum1 += v1;                                                   \
+                squares1 += v1 * v1;                                          \
+                sum2 += v2;                                                   \
+                squares2 += v2 * v2;                                          \
+            }                                                                 \
+        } while (0)
+
+        for (; x + 3 * step < units; x += 4 * step) {
+            SUM_UNIT(x);
+            SUM_UNIT(x + step);
+            SUM_UNIT(x + 2 * step);
+            SUM_UNIT(x + 3 * step);
+            count += 4;
+        }
+        for (; x < units; x += step) {
+            SUM_UNIT(x);
+            count++;
+        }
+#undef SUM_UNIT
+
+        sums[0].count += chromaShared ? 2 * count : count;
+        sums[0].sum += sum0;
+        sums[0].sum_squares += squares0;
+        sums[1].count += count;
+        sums[1].sum += sum1;
+        sums[1].sum_squares += squares1;
+        sums[2].count += count;
+        sums[2].sum += sum2;
+        sums[2].sum_squares += squares2;
+    }
+}
+
+#define DEFINE_SUM_FUNCTION(name, frametype, chromaShared, a, b, c, d)                                           \
+    static void sum##name(ChannelSums sums[FRAME_STATS_CHANNELS], const uint8_t* data, uint32_t width,          \
+                          uint32_t height, uint32_t stride, uint32_t step)                                     \
+    {                                                                                                           \
+        sumLayout(sums, data, width, height, stride, step, chromaShared, a, b, c, d);                          \
+    }
+PIXEL_LAYOUTS(DEFINE_SUM_FUNCTION)
+#undef DEFINE_SUM_FUNCTION
+
+#define KERNEL_ENTRY(name, frametype, chromaShared, a, b, c, d) { frametype, chromaShared, sum##name },
+static const FrameStatsKernel cKernels[] = {
+    PIXEL_LAYOUTS(KERNEL_ENTRY)
+};
+#undef KERNEL_ENTRY
+
+const FrameStatsKernel* frame_stats_kernel(camera_frametype_t frametype)
+{
+    for (size_t i = 0; i < sizeof(cKernels) / sizeof(cKernels[0]); i++) {
+        if (cKernels[i].frametype == frametype) {
+            return &cKernels[i];
+        }
+    }
+    return NULL;
+}
+
+int frame_stats_compute(const FrameStatsKernel* kernel, const camera_buffer_t* buffer, uint32_t step,
+                        FrameStats* stats)
+{
+    uint32_t width = 0, height = 0, stride = 0;
+    ChannelSums sums[FRAME_STATS_CHANNELS];
+    uint64_t population[FRAME_STATS_CHANNELS];
+
+    if ((kernel == NULL) || (kernel->frametype != buffer->frametype) || (step == 0)) {
+        return -1;
+    }
+    frame_get_dimensions(buffer->frametype, &buffer->framedesc, &width, &height, &stride);
+    if ((width == 0) || (height == 0)) {
+        return -1;
+    }
+
+    memset(sums, 0, sizeof(sums));
+    kernel->sum(sums, buffer->framebuf, width, height, stride, step);
+
+    // Chroma is shared by two pixels in YUV frames
+    uint32_t units = pixel_layout_units(kernel->chroma_shared, width);
+    population[1] = (uint64_t)units * height;
+    population[2] = population[1];
+    population[0] = kernel->chroma_shared ? 2 * population[1] : population[1];
+
+    FrameStats result = { .step = step };
+    for (int chan = 0; chan < FRAME_STATS_CHANNELS; chan++) {
+        double n = (double)sums[chan].count;
+        result.samples[chan] = (uint32_t)sums[chan].count;
+        if (sums[chan].count == 0) {
+            continue;
+        }
+        result.mean[chan] = (double)sums[chan].sum / n;
+        if ((sums[chan].count > 1) && (sums[chan].count < population[chan])) {
+            double variance = ((double)sums[chan].sum_squares - (double)sums[chan].sum * result.mean[chan]) / (n - 1.0);
+            double sampled = n / (double)population[chan];
+            result.std_error[chan] = sqrt(fmax(variance, 0.0) / n * (1.0 - sampled));
+        }
+    }
+    *stats = result;
+
+    return 0;
+}
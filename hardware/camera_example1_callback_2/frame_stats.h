@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <camera/camera_api.h>
+
+/**
+ * @brief Number of channels: R, G, B for RGB frames, Y, Cb, Cr for YUV frames
+ */
+#define FRAME_STATS_CHANNELS (3)
+
+/**
+ * @brief Channel means of one frame
+ *
+ * With a @c step of 1 every value is counted and @c std_error is 0. With a
+ * larger step only every step-th row and column (macropixel for YUV) is
+ * counted, and @c std_error estimates the standard error of each mean from
+ * the spread of the samples, corrected for the fraction of the frame sampled.
+ */
+typedef struct {
+    uint32_t step;
+    uint32_t samples[FRAME_STATS_CHANNELS];
+    double mean[FRAME_STATS_CHANNELS];
+    double std_error[FRAME_STATS_CHANNELS];
+} FrameStats;
+
+/**
+ * @brief Statistics kernel specialised for one frametype
+ */
+typedef struct FrameStatsKernel FrameStatsKernel;
+
+/**
+ * @brief Picks the statistics kernel of a frametype, once per stream
+ *
+ * @return Kernel, or NULL if the frametype is not supported
+ */
+const FrameStatsKernel* frame_stats_kernel(camera_frametype_t frametype);
+
+/**
+ * @brief Computes the channel means of a frame
+ *
+ * @param kernel Kernel returned by @c frame_stats_kernel for the frame's frametype
+ * @param buffer Frame to measure
+ * @param step Sampling step in rows and columns, 1 for exact means
+ * @param stats Receives the means; left untouched on failure
+ * @return 0 on success, -1 if there is no kernel for the frame
+ */
+int frame_stats_compute(const FrameStatsKernel* kernel, const camera_buffer_t* buffer, uint32_t step,
+                        FrameStats* stats);
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram_engine.h"
+
+/**
+ * @brief How long the first worker waits for a frame before checking whether to stop
+ */
+#define HISTOGRAM_WAIT_MS (100)
+
+/**
+ * @brief Largest sampling step accepted
+ */
+#define HISTOGRAM_MAX_STEP (64)
+
+int histogram_parse(const char* spec, HistogramConfig* config)
+{
+    char* end;
+    long workers = strtol(spec, &end, 10);
+    long step = 1;
+
+    if ((end == spec) || (workers < 0) || (workers > HISTOGRAM_MAX_WORKERS)) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char* stepSpec = end + 1;
+        step = strtol(stepSpec, &end, 10);
+        if ((end == stepSpec) || (step < 1) || (step > HISTOGRAM_MAX_STEP)) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    config->workers = (int)workers;
+    config->step = (uint32_t)step;
+    return 0;
+}
+
+/**
+ * @brief Counts tiles of the current frame into the worker's bins until none are left
+ */
+static void countTiles(HistogramWorker* worker)
+{
+    HistogramEngine* engine = worker->engine;
+    const Frame* frame = engine->frame;
+    uint32_t step = engine->config.step;
+
+    memset(worker->bins, 0, sizeof(worker->bins));
+    for (;;) {
+        uint32_t tile = atomic_fetch_add_explicit(&engine->next_tile, 1, memory_order_relaxed);
+        if (tile >= engine->tile_count) {
+            break;
+        }
+        engine->kernel(worker->bins, frame->mapped_data, engine->width, engine->height, engine->stride,
+                       tile * HISTOGRAM_TILE_ROWS * step, HISTOGRAM_TILE_ROWS, step);
+    }
+}
+
+/**
+ * @brief Sums the sub-histograms of every worker into the engine's result
+ */
+static void mergeBins(HistogramEngine* engine, const Frame* frame)
+{
+    FrameHistogram* result = &engine->result;
+
+    memset(result, 0, sizeof(*result));
+    result->timestamp = frame->timestamp;
+    result->step = engine->config.step;
+    for (int i = 0; i < engine->started; i++) {
+        const HistogramWorker* worker = &engine->workers[i];
+        for (int chan = 0; chan < HISTOGRAM_CHANNELS; chan++) {
+            for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+                result->bins[chan][bin] += worker->bins[chan][bin];
+            }
+        }
+    }
+    for (int chan = 0; chan < HISTOGRAM_CHANNELS; chan++) {
+        for (int bin = 0; bin < HISTOGRAM_BINS; bin++) {
+            result->samples[chan] += result->bins[chan][bin];
+        }
+    }
+}
+
+/**
+ * @brief Helper worker: counts tiles of every frame the first worker hands out
+ */
+static void* helperThread(void* arg)
+{
+    HistogramWorker* worker = (HistogramWorker*)arg;
+    HistogramEngine* engine = worker->engine;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&engine->lock);
+    for (;;) {
+        while (!engine->stopping && (engine->generation == seen)) {
+            pthread_cond_wait(&engine->start, &engine->lock);
+        }
+        if (engine->stopping) {
+            break;
+        }
+        seen = engine->generation;
+        pthread_mutex_unlock(&engine->lock);
+
+        countTiles(worker);
+
+        pthread_mutex_lock(&engine->lock);
+        if (--engine->busy == 0) {
+            pthread_cond_signal(&engine->done);
+        }
+    }
+    pthread_mutex_unlock(&engine->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief First worker: takes frames from the ring, shares out their tiles and publishes the merged histogram
+ */
+static void* mainThread(void* arg)
+{
+    HistogramWorker* worker = (HistogramWorker*)arg;
+    HistogramEngine* engine = worker->engine;
+    uint64_t last_sequence = 0;
+
+    while (atomic_load_explicit(&engine->running, memory_order_relaxed)) {
+        Frame* frame = frame_ring_wait_latest(engine->ring, last_sequence, HISTOGRAM_WAIT_MS);
+        if (frame == NULL) {
+            continue;
+        }
+        last_sequence = frame->sequence;
+        if (!stage_rate_due(&engine->rate, frame->timestamp)) {
+            frame_ring_release(frame);
+            continue;
+        }
+
+        // The frametype only changes with the stream, so the kernel is picked once
+        if ((engine->kernel == NULL) || (engine->kernel_frametype != frame->frametype)) {
+            engine->kernel = frame_histogram_kernel(frame->frametype);
+            engine->kernel_frametype = frame->frametype;
+        }
+        uint32_t width = 0, height = 0, stride = 0;
+        frame_get_dimensions(frame->frametype, &frame->framedesc, &width, &height, &stride);
+        if ((engine->kernel == NULL) || (height == 0)) {
+            frame_ring_release(frame);
+            continue;
+        }
+
+        uint32_t rows = (height + engine->config.step - 1) / engine->config.step;
+        pthread_mutex_lock(&engine->lock);
+        engine->frame = frame;
+        engine->width = width;
+        engine->height = height;
+        engine->stride = stride;
+        engine->tile_count = (rows + HISTOGRAM_TILE_ROWS - 1) / HISTOGRAM_TILE_ROWS;
+        atomic_store_explicit(&engine->next_tile, 0, memory_order_relaxed);
+        engine->busy = engine->started - 1;
+        engine->generation++;
+        pthread_cond_broadcast(&engine->start);
+        pthread_mutex_unlock(&engine->lock);
+
+        countTiles(worker);
+
+        pthread_mutex_lock(&engine->lock);
+        while (engine->busy > 0) {
+            pthread_cond_wait(&engine->done, &engine->lock);
+        }
+        engine->frame = NULL;
+        pthread_mutex_unlock(&engine->lock);
+
+        mergeBins(engine, frame);
+        frame_ring_release(frame);
+        camera_metadata_publish_histogram(engine->metadata, &engine->result);
+        engine->frames++;
+    }
+
+    return NULL;
+}
+
+int histogram_engine_start(HistogramEngine* engine, const HistogramConfig* config, FrameRing* ring,
+                           Metadata* metadata, const StageRate* rate)
+{
+    memset(engine, 0, sizeof(*engine));
+    if ((config->workers < 1) || (config->workers > HISTOGRAM_MAX_WORKERS) || (config->step == 0)) {
+        return -1;
+    }
+    engine->config = *config;
+    engine->ring = ring;
+    engine->metadata = metadata;
+    if (rate) {
+        engine->rate = *rate;
+    } else {
+        stage_rate_init(&engine->rate);
+    }
+    pthread_mutex_init(&engine->lock, NULL);
+    pthread_cond_init(&engine->start, NULL);
+    pthread_cond_init(&engine->done, NULL);
+    atomic_init(&engine->next_tile, 0);
+
+    // Helpers first, so the first worker never waits for one that doesn't exist
+    for (int i = 1; i < config->workers; i++) {
+        engine->workers[i].engine = engine;
+        if (pthread_create(&engine->workers[i].thread, NULL, helperThread, &engine->workers[i]) != 0) {
+            printf("Failed to create histogram thread\n");
+            break;
+        }
+        engine->started = i + 1;
+    }
+    if (engine->started == 0) {
+        engine->started = 1;
+    }
+    engine->workers[0].engine = engine;
+    atomic_init(&engine->running, true);
+    if (pthread_create(&engine->workers[0].thread, NULL, mainThread, &engine->workers[0]) != 0) {
+        printf("Failed to create histogram thread\n");
+        atomic_store(&engine->running, false);
+        histogram_engine_stop(engine);
+        return -1;
+    }
+
+    return 0;
+}
+
+void histogram_engine_stop(HistogramEngine* engine)
+{
+    if (atomic_load(&engine->running)) {
+        atomic_store(&engine->running, false);
+        pthread_join(engine->workers[0].thread, NULL);
+    }
+
+    pthread_mutex_lock(&engine->lock);
+    engine->stopping = true;
+    pthread_cond_broadcast(&engine->start);
+    pthread_mutex_unlock(&engine->lock);
+    for (int i = 1; i < engine->started; i++) {
+        pthread_join(engine->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&engine->done);
+    pthread_cond_destroy(&engine->start);
+    pthread_mutex_destroy(&engine->lock);
+    engine->started = 0;
+}
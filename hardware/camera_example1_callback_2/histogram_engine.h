@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HISTOGRAM_ENGINE_H
+#define HISTOGRAM_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "frame_histogram.h"
+#include "frame_ring.h"
+#include "camera_metadata.h"
+#include "stage_rate.h"
+
+/**
+ * @brief Maximum number of threads computing one histogram
+ */
+#define HISTOGRAM_MAX_WORKERS (4)
+
+/**
+ * @brief Number of sampled rows per tile handed to a worker
+ */
+#define HISTOGRAM_TILE_ROWS (16)
+
+/**
+ * @brief Number of threads and sampling step of the histogram engine
+ *
+ * A @c workers count of 0 disables the engine.
+ */
+typedef struct {
+    int workers;
+    uint32_t step;
+} HistogramConfig;
+
+typedef struct HistogramEngine HistogramEngine;
+
+/**
+ * @brief One histogram thread and its private sub-histograms
+ */
+typedef struct {
+    HistogramEngine* engine;
+    pthread_t thread;
+    uint32_t bins[HISTOGRAM_CHANNELS][HISTOGRAM_BINS];
+} HistogramWorker;
+
+/**
+ * @brief Histogram engine of one pipeline
+ *
+ * The first worker takes frames from the ring and splits each into tiles of
+ * rows. All workers, the first included, pull tiles until none are left and
+ * count them into their own bins, so they never write to shared memory. The
+ * first worker then merges the bins and publishes the result on the metadata
+ * page.
+ */
+struct HistogramEngine {
+    HistogramConfig config;
+    FrameRing* ring;
+    Metadata* metadata;
+    StageRate rate;
+    HistogramWorker workers[HISTOGRAM_MAX_WORKERS];
+    int started;
+    atomic_bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int busy;
+    bool stopping;
+    FrameHistogramKernel kernel;
+    camera_frametype_t kernel_frametype;
+    const Frame* frame;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t tile_count;
+    atomic_uint next_tile;
+    FrameHistogram result;
+    uint64_t frames;
+};
+
+/**
+ * @brief Parses "<workers>[:<step>]", e.g. "2:2"
+ *
+ * @return 0 on success, -1 if @c spec is malformed or out of range
+ */
+int histogram_parse(const char* spec, HistogramConfig* config);
+
+/**
+ * @brief Starts the worker threads
+ *
+ * @param engine Engine state
+ * @param config Number of workers (1 to @c HISTOGRAM_MAX_WORKERS) and sampling step
+ * @param ring Ring to take frames from
+ * @param metadata Metadata page the histograms are published on
+ * @param rate Rate at which histograms are computed, or NULL for every frame
+ * @return 0 on success, -1 on failure
+ */
+int histogram_engine_start(HistogramEngine* engine, const HistogramConfig* config, FrameRing* ring,
+                           Metadata* metadata, const StageRate* rate);
+
+/**
+ * @brief Stops and joins the worker threads
+ */
+void histogram_engine_stop(HistogramEngine* engine);
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <jpeglib.h>
+#include "jpeg_stream.h"
+
+/**
+ * @brief How long the encoder waits for a frame before rechecking for shutdown
+ */
+#define ENCODER_WAIT_MS (100)
+
+/**
+ * @brief libjpeg destination writing into a fixed buffer
+ *
+ * A JPEG that does not fit is flagged and the remainder is written over the
+ * start of the buffer, so nothing is ever allocated.
+ */
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    uint8_t* buffer;
+    size_t capacity;
+    bool overflow;
+} FixedDestination;
+
+static void initDestination(j_compress_ptr cinfo)
+{
+    FixedDestination* dest = (FixedDestination*)cinfo->dest;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = dest->capacity;
+    dest->overflow = false;
+}
+
+static boolean emptyDestination(j_compress_ptr cinfo)
+{
+    FixedDestination* dest = (FixedDestination*)cinfo->dest;
+    dest->overflow = true;
+    dest->pub.next_output_byte = dest->buffer;
+    dest->pub.free_in_buffer = dest->capacity;
+    return TRUE;
+}
+
+static void termDestination(j_compress_ptr cinfo)
+{
+    (void)cinfo;
+}
+
+int compress_to_jpeg(struct jpeg_compress_struct* cinfo, uint8_t* rgb_data, int width, int height,
+                     uint8_t* jpeg_data, size_t capacity, unsigned long* jpeg_size) {
+    FixedDestination dest = {
+        .pub = {
+            .init_destination = initDestination,
+            .empty_output_buffer = emptyDestination,
+            .term_destination = termDestination,
+        },
+        .buffer = jpeg_data,
+        .capacity = capacity,
+    };
+    JSAMPROW row_pointer[1];
+    cinfo->dest = &dest.pub;
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = JCS_RGB;
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, 75, TRUE);
+    jpeg_start_compress(cinfo, TRUE);
+    while (cinfo->next_scanline < cinfo->image_height) {
+        row_pointer[0] = &rgb_data[cinfo->next_scanline * width * 3];
+        jpeg_write_scanlines(cinfo, row_pointer, 1);
+    }
+    jpeg_finish_compress(cinfo);
+    cinfo->dest = NULL;
+    *jpeg_size = (unsigned long)(dest.capacity - dest.pub.free_in_buffer);
+    return dest.overflow ? 0 : 1;
+}
+
+/**
+ * @brief Packs an RGB8888 frame into 24-bit RGB
+ *
+ * @return 0 on success, -1 if the frame cannot be encoded or doesn't fit into @c rgb_data
+ */
+static int packFrame(const Frame* frame, uint8_t* rgb_data, size_t capacity, uint32_t* outWidth, uint32_t* outHeight)
+{
+    if (frame->frametype != CAMERA_FRAMETYPE_RGB8888) {
+        return -1;
+    }
+    uint32_t width = frame->framedesc.rgb8888.width;
+    uint32_t height = frame->framedesc.rgb8888.height;
+    uint32_t stride = frame->framedesc.rgb8888.stride;
+    if ((width == 0) || (height == 0) || ((size_t)width * height * 3 > capacity)) {
+        return -1;
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            rgb_data[(y * width + x) * 3] = frame->mapped_data[y * stride + x * 4];
+            rgb_data[(y * width + x) * 3 + 1] = frame->mapped_data[y * stride + x * 4 + 1];
+            rgb_data[(y * width + x) * 3 + 2] = frame->mapped_data[y * stride + x * 4 + 2];
+        }
+    }
+    *outWidth = width;
+    *outHeight = height;
+    return 0;
+}
+
+static void* encoderThread(void* arg)
+{
+    JpegStream* stream = (JpegStream*)arg;
+    FrameArena* arena = stream->arena;
+    uint64_t last_sequence = 0;
+
+    while (stream->running) {
+        Frame* frame = frame_ring_wait_latest(stream->ring, last_sequence, ENCODER_WAIT_MS);
+        if (frame == NULL) {
+            continue;
+        }
+        last_sequence = frame->sequence;
+        if (!stage_rate_due(&stream->stream_rate, frame->timestamp)) {
+            frame_ring_release(frame);
+            continue;
+        }
+        FlightRecorderEntry entry = {
+            .sequence = frame->sequence,
+            .timestamp = frame->timestamp,
+            .flags = FLIGHT_RECORDER_ENTRY_JPEG,
+            .frametype = (uint32_t)frame->frametype,
+        };
+
+        // Size the buffers from the first frame if the resolution wasn't known at start
+        if (!frame_arena_ready(arena)) {
+            uint32_t width = 0, height = 0, stride = 0;
+            frame_get_dimensions(frame->frametype, &frame->framedesc, &width, &height, &stride);
+            if (frame_arena_reserve(arena, width, height) != 0) {
+                frame_ring_release(frame);
+                continue;
+            }
+        }
+
+        // Only hold the slot for as long as the conversion reads from it
+        uint32_t width = 0, height = 0;
+        uint8_t* rgb_data = frame_pool_get(&arena->rgb);
+        int packed = (rgb_data != NULL) ? packFrame(frame, rgb_data, arena->rgb.block_size, &width, &height) : -1;
+        frame_ring_release(frame);
+        if (packed != 0) {
+            frame_pool_put(&arena->rgb, rgb_data);
+            continue;
+        }
+
+        // One JPEG buffer is always free: at most one is pending and one is being sent
+        uint8_t* jpeg_data = frame_pool_get(&arena->jpeg);
+        unsigned long jpeg_size = 0;
+        int compressed = (jpeg_data != NULL)
+                       ? compress_to_jpeg(&stream->cinfo, rgb_data, width, height, jpeg_data,
+                                          arena->jpeg.block_size, &jpeg_size)
+                       : 0;
+        frame_pool_put(&arena->rgb, rgb_data);
+        if (!compressed) {
+            frame_pool_put(&arena->jpeg, jpeg_data);
+            stream->overflows++;
+            continue;
+        }
+        if (stream->recorder && stage_rate_due(&stream->record_rate, entry.timestamp)) {
+            entry.width = width;
+            entry.height = height;
+            (void)flight_recorder_append(stream->recorder, jpeg_data, jpeg_size, entry);
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        frame_pool_put(&arena->jpeg, stream->pending_jpeg);
+        stream->pending_jpeg = jpeg_data;
+        stream->pending_size = jpeg_size;
+        stream->encoded++;
+        pthread_cond_signal(&stream->jpeg_ready);
+        pthread_mutex_unlock(&stream->lock);
+
+        // Every buffer has been used once; from here on nothing may allocate
+        frame_arena_seal(arena);
+    }
+
+    return NULL;
+}
+
+static void* senderThread(void* arg)
+{
+    JpegStream* stream = (JpegStream*)arg;
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->running) {
+        if (stream->pending_jpeg == NULL) {
+            pthread_cond_wait(&stream->jpeg_ready, &stream->lock);
+            continue;
+        }
+        uint8_t* jpeg_data = stream->pending_jpeg;
+        unsigned long jpeg_size = stream->pending_size;
+        stream->pending_jpeg = NULL;
+        pthread_mutex_unlock(&stream->lock);
+
+        if (stream->sock != -1) {
+            send(stream->sock, &jpeg_size, sizeof(unsigned long), 0);
+            send(stream->sock, jpeg_data, jpeg_size, 0);
+        }
+        frame_pool_put(&stream->arena->jpeg, jpeg_data);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->sent++;
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+int jpeg_stream_start(JpegStream* stream, FrameRing* ring, FrameArena* arena, int sock, FlightRecorder* recorder,
+                      const StageRate* stream_rate, const StageRate* record_rate)
+{
+    memset(stream, 0, sizeof(*stream));
+    stream->ring = ring;
+    stream->arena = arena;
+    stream->recorder = recorder;
+    stream->sock = sock;
+    if (stream_rate) {
+        stream->stream_rate = *stream_rate;
+    } else {
+        stage_rate_init(&stream->stream_rate);
+    }
+    if (record_rate) {
+        stream->record_rate = *record_rate;
+    } else {
+        stage_rate_init(&stream->record_rate);
+    }
+    atomic_init(&stream->running, true);
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->jpeg_ready, NULL);
+    stream->cinfo.err = jpeg_std_error(&stream->jerr);
+    jpeg_create_compress(&stream->cinfo);
+
+    if (pthread_create(&stream->sender_thread, NULL, senderThread, stream) != 0) {
+        printf("Failed to create JPEG sender thread\n");
+        jpeg_destroy_compress(&stream->cinfo);
+        return -1;
+    }
+    if (pthread_create(&stream->encoder_thread, NULL, encoderThread, stream) != 0) {
+        printf("Failed to create JPEG encoder thread\n");
+        pthread_mutex_lock(&stream->lock);
+        stream->running = false;
+        pthread_cond_signal(&stream->jpeg_ready);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_join(stream->sender_thread, NULL);
+        jpeg_destroy_compress(&stream->cinfo);
+        return -1;
+    }
+
+    return 0;
+}
+
+void jpeg_stream_stop(JpegStream* stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->running = false;
+    pthread_cond_signal(&stream->jpeg_ready);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stream->encoder_thread, NULL);
+    pthread_join(stream->sender_thread, NULL);
+
+    frame_pool_put(&stream->arena->jpeg, stream->pending_jpeg);
+    stream->pending_jpeg = NULL;
+    jpeg_destroy_compress(&stream->cinfo);
+    pthread_cond_destroy(&stream->jpeg_ready);
+    pthread_mutex_destroy(&stream->lock);
+}
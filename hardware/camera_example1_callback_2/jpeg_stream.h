@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef JPEG_STREAM_H
+#define JPEG_STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <jpeglib.h>
+#include "frame_ring.h"
+#include "frame_arena.h"
+#include "flight_recorder.h"
+#include "stage_rate.h"
+
+/**
+ * @brief JPEG streaming of ring frames to a connected host
+ *
+ * The encoder thread holds a handle on the latest ring frame only while it
+ * converts it, then compresses it and hands it to the sender thread. The
+ * sender always sends the newest JPEG; older ones that were never sent are
+ * replaced so a slow link cannot back up the encoder. RGB and JPEG buffers
+ * come from the pipeline's arena and the compressor is created once, so
+ * encoding a frame does not allocate output buffers.
+ */
+typedef struct {
+    FrameRing* ring;
+    FrameArena* arena;
+    FlightRecorder* recorder;
+    StageRate stream_rate;
+    StageRate record_rate;
+    int sock;
+    atomic_bool running;
+    pthread_t encoder_thread;
+    pthread_t sender_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t jpeg_ready;
+    uint8_t* pending_jpeg;
+    unsigned long pending_size;
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    uint64_t encoded;
+    uint64_t sent;
+    uint64_t overflows;
+} JpegStream;
+
+/**
+ * @brief Compresses a packed RGB image to JPEG into a caller-provided buffer
+ *
+ * @param cinfo Compressor created with @c jpeg_create_compress; reused across images
+ * @param rgb_data Packed 24-bit RGB pixels
+ * @param width Image width in pixels
+ * @param height Image height in pixels
+ * @param jpeg_data Buffer the JPEG is written to
+ * @param capacity Size of @c jpeg_data in bytes
+ * @param jpeg_size Receives the JPEG size in bytes
+ * @return 1 on success, 0 if the JPEG did not fit into @c jpeg_data
+ */
+int compress_to_jpeg(struct jpeg_compress_struct* cinfo, uint8_t* rgb_data, int width, int height,
+                     uint8_t* jpeg_data, size_t capacity, unsigned long* jpeg_size);
+
+/**
+ * @brief Starts the encoder and sender threads
+ *
+ * @param stream Stream state
+ * @param ring Ring to take frames from
+ * @param arena Arena the RGB and JPEG buffers are taken from
+ * @param sock Connected socket the JPEGs are sent on, or -1 to encode without sending
+ * @param recorder Flight recorder that also receives the JPEGs, or NULL
+ * @param stream_rate Rate at which ring frames are encoded and sent, or NULL for every frame
+ * @param record_rate Rate at which encoded JPEGs are passed to @c recorder, or NULL for every JPEG
+ * @return 0 on success, -1 on failure
+ */
+int jpeg_stream_start(JpegStream* stream, FrameRing* ring, FrameArena* arena, int sock, FlightRecorder* recorder,
+                      const StageRate* stream_rate, const StageRate* record_rate);
+
+/**
+ * @brief Stops and joins the encoder and sender threads
+ *
+ * @c frame_ring_stop must have been called on the ring first so the encoder
+ * is not left waiting for a frame.
+ */
+void jpeg_stream_stop(JpegStream* stream);
+
+#endif
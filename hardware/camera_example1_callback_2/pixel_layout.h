@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PIXEL_LAYOUT_H
+#define PIXEL_LAYOUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <camera/camera_api.h>
+
+/**
+ * @brief Byte layout of every supported frametype, for generating one pixel kernel per frametype
+ *
+ * Expands X(name, frametype, chroma_shared, a, b, c, d) once per frametype.
+ * Every layout is made of 4-byte units. Without shared chroma a unit is one
+ * pixel and @c a, @c b, @c c are the offsets of R, G and B. With shared
+ * chroma a unit is a macropixel of two pixels: @c a and @c b are the offsets
+ * of their lumas, @c c and @c d those of Cb and Cr.
+ *
+ * A kernel is written once as a @c PIXEL_KERNEL_INLINE function taking the
+ * layout as arguments, and instantiated per frametype from this list, so the
+ * offsets are constants and the layout decisions fold away in each instance.
+ */
+#define PIXEL_LAYOUTS(X)                                        \
+    X(Rgb8888, CAMERA_FRAMETYPE_RGB8888, false, 0, 1, 2, 3)     \
+    X(Bgr8888, CAMERA_FRAMETYPE_BGR8888, false, 2, 1, 0, 3)     \
+    X(Ycbycr, CAMERA_FRAMETYPE_YCBYCR, true, 0, 2, 1, 3)        \
+    X(Cbycry, CAMERA_FRAMETYPE_CBYCRY, true, 1, 3, 0, 2)
+
+/**
+ * @brief Size of a layout unit in bytes
+ */
+#define PIXEL_UNIT_BYTES (4)
+
+/**
+ * @brief Generic kernel body that every instance inlines with its layout constants
+ */
+#define PIXEL_KERNEL_INLINE static inline __attribute__((always_inline))
+
+/**
+ * @brief Number of layout units in a row of @c width pixels
+ */
+static inline uint32_t pixel_layout_units(bool chroma_shared, uint32_t width)
+{
+    return chroma_shared ? width / 2 : width;
+}
+
+#endif
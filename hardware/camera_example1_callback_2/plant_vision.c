@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include "plant_vision.h"
+#include "frame_ring.h"
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define PLANT_VISION_NEON
+#endif
+
+/**
+ * @brief Excess green of a YCbCr pixel in 1/16 units is -(CB_WEIGHT * Cb' + CR_WEIGHT * Cr')
+ *
+ * With R, G and B written in terms of Y, Cb' and Cr' (BT.601), 2G - R - B
+ * does not depend on Y: it is -2.46 Cb' - 2.83 Cr'.
+ */
+#define CB_WEIGHT (39)
+#define CR_WEIGHT (45)
+
+/**
+ * @brief Plant pixel moments of one row, with x in samples (pixels or macropixels)
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_x;
+    uint64_t sum_xx;
+} RowMoments;
+
+/**
+ * @brief Plant pixel moments of a frame in pixel coordinates
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_x;
+    uint64_t sum_y;
+    uint64_t sum_xx;
+    uint64_t sum_yy;
+    uint64_t sum_xy;
+} FrameMoments;
+
+static inline void addSample(RowMoments* row, uint64_t x)
+{
+    row->count++;
+    row->sum_x += x;
+    row->sum_xx += x * x;
+}
+
+static inline bool isPlantRgb(const uint8_t* pixel, uint32_t redOffset)
+{
+    int exg = 2 * pixel[1] - pixel[redOffset] - pixel[2 - redOffset];
+    return exg > PLANT_VISION_THRESHOLD;
+}
+
+static inline bool isPlantYuv(const uint8_t* macropixel, uint32_t cbOffset)
+{
+    int cb = (int)macropixel[cbOffset] - 128;
+    int cr = (int)macropixel[cbOffset + 2] - 128;
+    return CB_WEIGHT * cb + CR_WEIGHT * cr < -16 * PLANT_VISION_THRESHOLD;
+}
+
+#ifdef PLANT_VISION_NEON
+static const uint8_t cLaneIndex[16] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+static const uint8_t cLaneIndexSquared[16] = { 0, 1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225 };
+
+/**
+ * @brief Adds the samples x0..x0+15 selected by @c mask (0 or 1 per lane) to the row moments
+ */
+static inline void addMask(RowMoments* row, uint8x16_t mask, uint64_t x0)
+{
+    uint64_t count = vaddvq_u8(mask);
+    if (count == 0) {
+        return;
+    }
+    uint64_t sumIndex = vaddvq_u16(vmull_u8(vget_low_u8(mask), vld1_u8(cLaneIndex)))
+                      + vaddvq_u16(vmull_u8(vget_high_u8(mask), vld1_u8(cLaneIndex + 8)));
+    uint64_t sumIndexSquared = vaddvq_u16(vmull_u8(vget_low_u8(mask), vld1_u8(cLaneIndexSquared)))
+                             + vaddvq_u16(vmull_u8(vget_high_u8(mask), vld1_u8(cLaneIndexSquared + 8)));
+    row->count += count;
+    row->sum_x += x0 * count + sumIndex;
+    row->sum_xx += x0 * x0 * count + 2 * x0 * sumIndex + sumIndexSquared;
+}
+
+/**
+ * @brief Excess green > threshold for 8 pixels, as 0xffff lanes
+ */
+static inline uint16x8_t plantRgb8(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+    // 2G - R - B wraps correctly in 16 bits as it stays within +-510
+    int16x8_t exg = vreinterpretq_s16_u16(vsubq_u16(vshll_n_u8(g, 1), vaddl_u8(r, b)));
+    return vcgtq_s16(exg, vdupq_n_s16(PLANT_VISION_THRESHOLD));
+}
+
+/**
+ * @brief Excess green > threshold for 8 macropixels, as 0xffff lanes
+ */
+static inline uint16x8_t plantYuv8(uint8x8_t cb, uint8x8_t cr)
+{
+    int16x8_t dcb = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(cb)), vdupq_n_s16(128));
+    int16x8_t dcr = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(cr)), vdupq_n_s16(128));
+    int16x8_t weighted = vmlaq_n_s16(vmulq_n_s16(dcb, CB_WEIGHT), dcr, CR_WEIGHT);
+    return vcltq_s16(weighted, vdupq_n_s16(-16 * PLANT_VISION_THRESHOLD));
+}
+
+static inline uint8x16_t toLaneMask(uint16x8_t low, uint16x8_t high)
+{
+    return vandq_u8(vcombine_u8(vmovn_u16(low), vmovn_u16(high)), vdupq_n_u8(1));
+}
+#endif
+
+/**
+ * @brief Segments one row of RGB8888 or BGR8888 pixels
+ */
+static void measureRowRgb(const uint8_t* line, uint32_t width, uint32_t redOffset, RowMoments* row)
+{
+    uint32_t x = 0;
+
+#ifdef PLANT_VISION_NEON
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x4_t px = vld4q_u8(line + 4 * x);
+        uint8x16_t r = (redOffset == 0) ? px.val[0] : px.val[2];
+        uint8x16_t b = (redOffset == 0) ? px.val[2] : px.val[0];
+        uint8x16_t mask = toLaneMask(plantRgb8(vget_low_u8(r), vget_low_u8(px.val[1]), vget_low_u8(b)),
+                                     plantRgb8(vget_high_u8(r), vget_high_u8(px.val[1]), vget_high_u8(b)));
+        addMask(row, mask, x);
+    }
+#endif
+    for (; x < width; x++) {
+        if (isPlantRgb(line + 4 * x, redOffset)) {
+            addSample(row, x);
+        }
+    }
+}
+
+/**
+ * @brief Segments one row of YCbYCr or CbYCrY macropixels (two pixels sharing chroma)
+ */
+static void measureRowYuv(const uint8_t* line, uint32_t macropixels, uint32_t cbOffset, RowMoments* row)
+{
+    uint32_t x = 0;
+
+#ifdef PLANT_VISION_NEON
+    for (; x + 16 <= macropixels; x += 16) {
+        uint8x16x4_t px = vld4q_u8(line + 4 * x);
+        uint8x16_t cb = (cbOffset == 0) ? px.val[0] : px.val[1];
+        uint8x16_t cr = (cbOffset == 0) ? px.val[2] : px.val[3];
+        uint8x16_t mask = toLaneMask(plantYuv8(vget_low_u8(cb), vget_low_u8(cr)),
+                                     plantYuv8(vget_high_u8(cb), vget_high_u8(cr)));
+        addMask(row, mask, x);
+    }
+#endif
+    for (; x < macropixels; x++) {
+        if (isPlantYuv(line + 4 * x, cbOffset)) {
+            addSample(row, x);
+        }
+    }
+}
+
+int plant_vision_measure(const camera_buffer_t* buffer, PlantVisionMetrics* metrics)
+{
+    uint32_t width = 0, height = 0, stride = 0;
+    bool yuv;
+    uint32_t offset;
+
+    switch (buffer->frametype) {
+    case CAMERA_FRAMETYPE_RGB8888:
+        yuv = false;
+        offset = 0;
+        break;
+    case CAMERA_FRAMETYPE_BGR8888:
+        yuv = false;
+        offset = 2;
+        break;
+    case CAMERA_FRAMETYPE_YCBYCR:
+        yuv = true;
+        offset = 1;
+        break;
+    case CAMERA_FRAMETYPE_CBYCRY:
+        yuv = true;
+        offset = 0;
+        break;
+    default:
+        return -1;
+    }
+    frame_get_dimensions(buffer->frametype, &buffer->framedesc, &width, &height, &stride);
+    if ((width == 0) || (height == 0)) {
+        return -1;
+    }
+
+    FrameMoments moments = { 0 };
+    uint64_t sampled = 0;
+    for (uint64_t y = 0; y < height; y += PLANT_VISION_ROW_STEP) {
+        const uint8_t* line = buffer->framebuf + y * stride;
+        RowMoments row = { 0, 0, 0 };
+        if (yuv) {
+            // Macropixel m covers pixels 2m and 2m + 1
+            RowMoments macro = { 0, 0, 0 };
+            measureRowYuv(line, width / 2, offset, &macro);
+            row.count = 2 * macro.count;
+            row.sum_x = 4 * macro.sum_x + macro.count;
+            row.sum_xx = 8 * macro.sum_xx + 4 * macro.sum_x + macro.count;
+        } else {
+            measureRowRgb(line, width, offset, &row);
+        }
+        moments.count += row.count;
+        moments.sum_x += row.sum_x;
+        moments.sum_xx += row.sum_xx;
+        moments.sum_y += y * row.count;
+        moments.sum_yy += y * y * row.count;
+        moments.sum_xy += y * row.sum_x;
+        sampled += width;
+    }
+
+    PlantVisionMetrics result = { .timestamp = buffer->frametimestamp };
+    result.coverage = (float)((double)moments.count / (double)sampled);
+    if (moments.count > 0) {
+        double n = (double)moments.count;
+        double meanX = (double)moments.sum_x / n;
+        double meanY = (double)moments.sum_y / n;
+        double mu20 = (double)moments.sum_xx / n - meanX * meanX;
+        double mu02 = (double)moments.sum_yy / n - meanY * meanY;
+        double mu11 = (double)moments.sum_xy / n - meanX * meanY;
+        result.centroid_x = (float)(meanX / width);
+        result.centroid_y = (float)(meanY / height);
+
+        // Principal axis, turned to point up (image y grows downwards)
+        double theta = 0.5 * atan2(2.0 * mu11, mu20 - mu02);
+        double dx = cos(theta);
+        double dy = sin(theta);
+        if (dy > 0.0) {
+            dx = -dx;
+            dy = -dy;
+        }
+        result.lean_angle_deg = (float)(atan2(dx, -dy) * 180.0 / M_PI);
+    }
+    *metrics = result;
+
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PLANT_VISION_H
+#define PLANT_VISION_H
+
+#include <stdint.h>
+#include <camera/camera_api.h>
+
+/**
+ * @brief Only every n-th row of a frame is segmented
+ */
+#define PLANT_VISION_ROW_STEP (4)
+
+/**
+ * @brief Excess green (2G - R - B, 0-255 scale) above which a pixel counts as plant
+ */
+#define PLANT_VISION_THRESHOLD (20)
+
+/**
+ * @brief Shape of the plant in one frame, segmented by excess green
+ *
+ * @c coverage is the fraction of sampled pixels classified as plant. The
+ * centroid is normalised to 0-1 of the frame width and height. The lean is
+ * the angle of the principal axis of the plant pixels from vertical in
+ * degrees, positive when the top leans to the right. Centroid and lean are 0
+ * while no plant pixels are found. @c timestamp is the frame timestamp the
+ * metrics were computed from, 0 before the first one.
+ */
+typedef struct {
+    int64_t timestamp;
+    float coverage;
+    float centroid_x;
+    float centroid_y;
+    float lean_angle_deg;
+} PlantVisionMetrics;
+
+/**
+ * @brief Segments the plant pixels of a frame and computes its metrics
+ *
+ * Uses NEON on aarch64 and an equivalent scalar kernel elsewhere; both give
+ * the same result.
+ *
+ * @param buffer Frame of one of the supported frametypes
+ * @param metrics Receives the metrics; left untouched on failure
+ * @return 0 on success, -1 if the frametype is not supported
+ */
+int plant_vision_measure(const camera_buffer_t* buffer, PlantVisionMetrics* metrics);
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Builds the GPIO resource manager client from motor_controls into this
+ * binary. Pulling it in through the source path would also pick up the
+ * servo example and its main().
+ */
+#include "../motor_controls/rpi_gpio.c"
+#include "../motor_controls/rpi_gpio_event.c"
+#include "../motor_controls/rpi_gpio_soft_pwm.c"
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "stage_rate.h"
+
+void stage_rate_init(StageRate* rate)
+{
+    memset(rate, 0, sizeof(*rate));
+    rate->every = 1;
+}
+
+int stage_rate_parse(const char* spec, StageRate* rate)
+{
+    char* end;
+    double value = strtod(spec, &end);
+    const atomic_bool* full_rate = rate->full_rate;
+
+    if ((end == spec) || (value <= 0.0)) {
+        return -1;
+    }
+    stage_rate_init(rate);
+    rate->full_rate = full_rate;
+    if (strcmp(end, "hz") == 0) {
+        rate->interval_us = (int64_t)(1000000.0 / value);
+        return 0;
+    }
+    if ((*end != '\0') || (value != (double)(uint32_t)value)) {
+        return -1;
+    }
+    // The first frame offered is always due
+    rate->every = (uint32_t)value;
+    rate->count = rate->every - 1;
+    return 0;
+}
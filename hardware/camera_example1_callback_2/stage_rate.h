@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STAGE_RATE_H
+#define STAGE_RATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/**
+ * @brief Rate policy of one processing stage
+ *
+ * A frame is due when it is the @c every-th frame offered to the stage and at
+ * least @c interval_us has passed since the last due frame. The default runs
+ * the stage on every frame. While the flag @c full_rate points to is set
+ * (e.g. during a burst), every frame is due regardless of the policy. A policy
+ * is only ever evaluated by the one thread that runs its stage, so it needs no
+ * locking.
+ */
+typedef struct {
+    uint32_t every;
+    uint32_t count;
+    int64_t interval_us;
+    int64_t next_us;
+    const atomic_bool* full_rate;
+} StageRate;
+
+/**
+ * @brief Initialises @c rate to run on every frame
+ */
+void stage_rate_init(StageRate* rate);
+
+/**
+ * @brief Parses a rate policy: "<n>" runs on every n-th frame, "<hz>hz" at most @c hz times per second
+ *
+ * @return 0 on success, -1 if @c spec is malformed
+ */
+int stage_rate_parse(const char* spec, StageRate* rate);
+
+/**
+ * @brief Returns true while the stage is forced to run on every frame
+ */
+static inline bool stage_rate_full(const StageRate* rate)
+{
+    return rate->full_rate && atomic_load_explicit(rate->full_rate, memory_order_relaxed);
+}
+
+/**
+ * @brief Decides whether the stage runs for a frame
+ *
+ * @param rate Rate policy of the stage
+ * @param timestamp_us Frame timestamp in microseconds
+ * @return true if the stage should process the frame
+ */
+static inline bool stage_rate_due(StageRate* rate, int64_t timestamp_us)
+{
+    if (stage_rate_full(rate)) {
+        return true;
+    }
+    if (rate->every > 1) {
+        if (++rate->count < rate->every) {
+            return false;
+        }
+        rate->count = 0;
+    }
+    if (rate->interval_us > 0) {
+        if (timestamp_us < rate->next_us) {
+            return false;
+        }
+        // Keep the cadence unless the stage fell more than a period behind
+        rate->next_us = (timestamp_us - rate->next_us < rate->interval_us) ? rate->next_us + rate->interval_us
+                                                                           : timestamp_us + rate->interval_us;
+    }
+    return true;
+}
+
+#endif
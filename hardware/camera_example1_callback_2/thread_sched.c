@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#if !defined(__QNXNTO__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thread_sched.h"
+
+#ifdef __QNXNTO__
+#include <sys/neutrino.h>
+#endif
+
+int thread_set_affinity(pthread_t thread, uint64_t cpu_mask)
+{
+    if (cpu_mask == 0) {
+        return 0;
+    }
+
+#ifdef __QNXNTO__
+    // pthread_t is the thread ID on QNX; a pid of 0 means this process
+    if (ThreadCtlExt(0, (int)thread, _NTO_TCTL_RUNMASK, (void*)(uintptr_t)(uint32_t)cpu_mask) == -1) {
+        return errno;
+    }
+    return 0;
+#else
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < 64; cpu++) {
+        if (cpu_mask & (1ULL << cpu)) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+    return pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+#endif
+}
+
+void thread_sched_default(ThreadSchedConfig* config)
+{
+    config->policy = THREAD_SCHED_INHERIT;
+    config->priority = 0;
+    config->cpu_mask = 0;
+}
+
+int thread_sched_parse(const char* spec, ThreadSchedConfig* config)
+{
+    static const struct {
+        const char* name;
+        int policy;
+    } cPolicies[] = {
+        { "fifo", SCHED_FIFO },
+        { "rr", SCHED_RR },
+        { "other", SCHED_OTHER },
+    };
+    const char* colon = strchr(spec, ':');
+    size_t nameLength = (colon != NULL) ? (size_t)(colon - spec) : strlen(spec);
+    int policy = THREAD_SCHED_INHERIT;
+    char* end;
+
+    for (size_t i = 0; i < sizeof(cPolicies) / sizeof(cPolicies[0]); i++) {
+        if ((strlen(cPolicies[i].name) == nameLength) && (strncmp(cPolicies[i].name, spec, nameLength) == 0)) {
+            policy = cPolicies[i].policy;
+            break;
+        }
+    }
+    if ((policy == THREAD_SCHED_INHERIT) || (colon == NULL)) {
+        return -1;
+    }
+
+    long priority = strtol(colon + 1, &end, 10);
+    if ((end == colon + 1) || ((*end != '\0') && (*end != ':'))) {
+        return -1;
+    }
+    if ((priority < sched_get_priority_min(policy)) || (priority > sched_get_priority_max(policy))) {
+        return -1;
+    }
+
+    uint64_t cpu_mask = config->cpu_mask;
+    if (*end == ':') {
+        const char* maskSpec = end + 1;
+        cpu_mask = strtoull(maskSpec, &end, 0);
+        if ((end == maskSpec) || (*end != '\0')) {
+            return -1;
+        }
+    }
+
+    config->policy = policy;
+    config->priority = (int)priority;
+    config->cpu_mask = cpu_mask;
+    return 0;
+}
+
+int thread_sched_apply(pthread_t thread, const ThreadSchedConfig* config)
+{
+    int err;
+
+    if (config->policy != THREAD_SCHED_INHERIT) {
+        // Maps onto ThreadCtl/SchedSet on QNX and sched_setscheduler on Linux
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        err = pthread_setschedparam(thread, config->policy, &param);
+        if (err != 0) {
+            return err;
+        }
+    }
+    return thread_set_affinity(thread, config->cpu_mask);
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2024, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_SCHED_H
+#define THREAD_SCHED_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/**
+ * @brief Policy value that leaves a thread's scheduling policy and priority untouched
+ */
+#define THREAD_SCHED_INHERIT (-1)
+
+/**
+ * @brief Scheduling of one thread: policy, priority and the CPUs it may run on
+ *
+ * @c policy is SCHED_FIFO, SCHED_RR, SCHED_OTHER or @c THREAD_SCHED_INHERIT;
+ * @c priority is only used when a policy is given. A @c cpu_mask of 0 leaves
+ * the affinity untouched.
+ */
+typedef struct {
+    int policy;
+    int priority;
+    uint64_t cpu_mask;
+} ThreadSchedConfig;
+
+/**
+ * @brief Initializes @c config to leave every scheduling attribute untouched
+ */
+void thread_sched_default(ThreadSchedConfig* config);
+
+/**
+ * @brief Parses "<policy>:<priority>[:<cpu_mask>]", e.g. "fifo:30:0x1"
+ *
+ * The policy is one of fifo, rr or other. Fields not present in @c spec are
+ * left as they are in @c config.
+ *
+ * @return 0 on success, -1 if @c spec is malformed or the priority is out of range
+ */
+int thread_sched_parse(const char* spec, ThreadSchedConfig* config);
+
+/**
+ * @brief Applies policy, priority and affinity from @c config to a thread
+ *
+ * @return 0 on success, an errno value of the first attribute that failed
+ */
+int thread_sched_apply(pthread_t thread, const ThreadSchedConfig* config);
+
+/**
+ * @brief Restricts a thread to the CPUs set in @c cpu_mask
+ *
+ * Uses the QNX runmask on target and the pthread affinity API on the host
+ * build. A mask of 0 leaves the thread unrestricted.
+ *
+ * @return 0 on success, an errno value on failure
+ */
+int thread_set_affinity(pthread_t thread, uint64_t cpu_mask);
+
+#endif
@@ -0,0 +1,34 @@
+#
+# Copyright (c) 2025, BlackBerry Limited. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+ifndef QCONFIG
+QCONFIG=qconfig.mk
+endif
+include $(QCONFIG)
+
+NAME=gpio_bench
+
+define PINFO
+PINFO DESCRIPTION=Benchmark of the GPIO client under concurrent use
+endef
+
+# The GPIO client (rpi_gpio_client.c) and its headers live one level up
+EXTRA_INCVPATH += $(PROJECT_ROOT)/..
+
+include $(MKFILES_ROOT)/qmacros.mk
+
+#This has to be included last
+include $(MKFILES_ROOT)/qtargets.mk
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2025, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <sys/neutrino.h>
+#include "public/rpi_gpio.h"
+
+// Largest number of threads sending at once
+#define MAX_THREADS 16
+
+// State and results of one sending thread
+typedef struct
+{
+    pthread_t thread;
+    int gpio_pin;
+    unsigned messages;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    unsigned errors;
+} bench_thread_t;
+
+// Connection policies, by name
+static const struct
+{
+    const char *name;
+    unsigned policy;
+} policies[] = {
+    {"serialised", GPIO_CONCURRENCY_SERIALISED},
+    {"shared", GPIO_CONCURRENCY_SHARED},
+    {"per-thread", GPIO_CONCURRENCY_PER_THREAD},
+};
+
+#define POLICY_COUNT (sizeof(policies) / sizeof(policies[0]))
+
+// Released once every thread has connected, so that all of them send at once
+static pthread_barrier_t start_barrier;
+
+/**
+ * @brief Reads the monotonic clock.
+ *
+ * @return The current time in nanoseconds.
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Reads the level of one pin over and over, timing every message.
+ *
+ * Reading leaves the pins as they are, so the benchmark is safe to run
+ * with devices attached.
+ *
+ * @param arg The thread's bench_thread_t.
+ * @return NULL.
+ */
+static void *bench_thread(void *arg)
+{
+    bench_thread_t *bench = arg;
+    unsigned level;
+
+    // The first message opens the connection, which is not what is measured
+    if (rpi_gpio_input(bench->gpio_pin, &level))
+    {
+        bench->errors++;
+    }
+
+    pthread_barrier_wait(&start_barrier);
+
+    for (unsigned i = 0; i < bench->messages; i++)
+    {
+        uint64_t start = now_ns();
+
+        if (rpi_gpio_input(bench->gpio_pin, &level))
+        {
+            bench->errors++;
+        }
+
+        uint64_t elapsed = now_ns() - start;
+        bench->total_ns += elapsed;
+        if (elapsed > bench->max_ns)
+        {
+            bench->max_ns = elapsed;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Runs every thread under one connection policy and prints the results.
+ *
+ * @param index Index of the policy in policies.
+ * @param thread_count Number of threads sending at once.
+ * @param messages Number of messages each thread sends.
+ * @param first_pin Pin read by the first thread; the others read the following pins.
+ * @return true if the run completed, false otherwise.
+ */
+static bool run_policy(unsigned index, unsigned thread_count, unsigned messages, int first_pin)
+{
+    bench_thread_t threads[MAX_THREADS];
+    unsigned started = 0;
+
+    if (rpi_gpio_set_concurrency(policies[index].policy))
+    {
+        perror("rpi_gpio_set_concurrency");
+        return false;
+    }
+
+    memset(threads, 0, sizeof(threads));
+    pthread_barrier_init(&start_barrier, NULL, thread_count + 1);
+
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        threads[i].gpio_pin = (first_pin + i) % GPIO_COUNT;
+        threads[i].messages = messages;
+        if (pthread_create(&threads[i].thread, NULL, bench_thread, &threads[i]))
+        {
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+
+    // Threads that failed to start never reach the barrier; stand in for them
+    for (unsigned i = started; i < thread_count; i++)
+    {
+        pthread_barrier_wait(&start_barrier);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    unsigned errors = 0;
+    for (unsigned i = 0; i < started; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        total_ns += threads[i].total_ns;
+        if (threads[i].max_ns > max_ns)
+        {
+            max_ns = threads[i].max_ns;
+        }
+        errors += threads[i].errors;
+    }
+
+    uint64_t elapsed = now_ns() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    // Close the connections of this run, so the next policy starts afresh
+    rpi_gpio_cleanup();
+
+    if (started < thread_count)
+    {
+        return false;
+    }
+
+    double sent = (double)started * messages;
+    printf("%-10s  %2u threads  %9.0f msg/s  mean %7.2f us  max %8.2f us  errors %u\n",
+           policies[index].name, started, sent * 1e9 / (double)elapsed, (double)total_ns / sent / 1000.0,
+           (double)max_ns / 1000.0, errors);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned thread_count = 2;
+    unsigned messages = 10000;
+    int first_pin = GPIO5;
+    int policy = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:n:p:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            thread_count = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'n':
+            messages = strtoul(optarg, NULL, 0);
+            break;
+
+        case 'p':
+            first_pin = strtol(optarg, NULL, 0);
+            break;
+
+        case 'c':
+            for (unsigned i = 0; i < POLICY_COUNT; i++)
+            {
+                if (strcmp(optarg, policies[i].name) == 0)
+                {
+                    policy = i;
+                }
+            }
+            if (policy == -1)
+            {
+                fprintf(stderr, "Unknown connection policy %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        default:
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (thread_count < 1 || thread_count > MAX_THREADS || messages == 0 || first_pin < 0 ||
+        first_pin >= GPIO_COUNT)
+    {
+        fprintf(stderr, "Threads must be 1-%d, messages at least 1 and the pin 0-%d\n", MAX_THREADS,
+                GPIO_COUNT - 1);
+        return EXIT_FAILURE;
+    }
+
+    // Without -c, compare every policy with the same load
+    for (unsigned i = 0; i < POLICY_COUNT; i++)
+    {
+        if (policy == -1 || policy == (int)i)
+        {
+            if (!run_policy(i, thread_count, messages, first_pin))
+            {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
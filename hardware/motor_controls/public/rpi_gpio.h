@@ -27,6 +27,9 @@
 #define GPIO_ERROR_MSG_EVENT_NOT_REGISTERED -3
 #define GPIO_ERROR_INPUT_OUT_OF_RANGE -4
 #define GPIO_ERROR_CLEANING_UP -5
+#define GPIO_ERROR_NOT_MAPPED -6
+#define GPIO_ERROR_NO_RESOURCES -7
+#define GPIO_ERROR_NO_EVENT -8
 
 /* GPIO PIN codes */
 #define GPIO_COUNT 28
@@ -60,6 +63,9 @@
 #define GPIO26 26
 #define GPIO27 27
 
+/* Every pin, for rpi_gpio_invalidate */
+#define GPIO_PIN_ALL -1
+
 /* GPIO pin configuration*/
 enum gpio_config_t
 {
@@ -96,6 +102,188 @@ enum pwm_channel_op_mode_t
     GPIO_PWM_MODE_MS = 1
 };
 
+/* How threads share connections to the GPIO resource manager */
+enum gpio_concurrency_t
+{
+    GPIO_CONCURRENCY_SERIALISED,  /* one connection, one message at a time */
+    GPIO_CONCURRENCY_SHARED,      /* one connection, messages from several threads in flight at once (default) */
+    GPIO_CONCURRENCY_PER_THREAD   /* one connection per thread */
+};
+
+/* Operations that can be collected in a batch */
+enum gpio_op_t
+{
+    GPIO_OP_SETUP,
+    GPIO_OP_PULL,
+    GPIO_OP_OUTPUT,
+    GPIO_OP_INPUT,
+    GPIO_OP_SETUP_PWM,
+    GPIO_OP_PWM_DUTY,
+    GPIO_OP_WRITE_MASK,
+    GPIO_OP_READ_ALL
+};
+
+/* Maximum number of operations in a batch */
+#define GPIO_BATCH_MAX 32
+
+/**
+ * One operation of a batch
+ *
+ * value holds the pin configuration (GPIO_OP_SETUP), pull direction
+ * (GPIO_OP_PULL), voltage level (GPIO_OP_OUTPUT), hardware PWM mode
+ * (GPIO_OP_SETUP_PWM) or pin levels (GPIO_OP_WRITE_MASK, with the pins in
+ * mask), and receives the voltage level for GPIO_OP_INPUT or the pin levels
+ * for GPIO_OP_READ_ALL. status receives the result of the operation, with
+ * the same codes as the single-operation functions.
+ */
+typedef struct
+{
+    unsigned op;
+    int gpio_pin;
+    unsigned mask;
+    unsigned value;
+    unsigned frequency;
+    float percentage;
+    int status;
+} rpi_gpio_op_t;
+
+/* Operations submitted to the GPIO resource manager together */
+typedef struct
+{
+    unsigned count;
+    rpi_gpio_op_t ops[GPIO_BATCH_MAX];
+} rpi_gpio_batch_t;
+
+/* Number of edges each pin can hold until they are taken */
+#define GPIO_EVENT_QUEUE_SIZE 64
+
+/**
+ * One edge on a pin, stamped by the event dispatcher when its pulse arrives
+ *
+ * edge is GPIO_RISING or GPIO_FALLING. cycles is the ClockCycles() count and
+ * time_ns the CLOCK_MONOTONIC time at which the pulse was received; cycles
+ * give the finer intervals between edges (see the qtime cycles_per_sec field
+ * of the system page). dropped counts the edges of the pin lost since the
+ * previous one because its queue was full.
+ */
+typedef struct
+{
+    int gpio_pin;
+    unsigned edge;
+    uint64_t cycles;
+    uint64_t time_ns;
+    unsigned dropped;
+} rpi_gpio_edge_t;
+
+/* Called by the event dispatcher thread for every edge of a pin */
+typedef void (*rpi_gpio_edge_callback_t)(const rpi_gpio_edge_t *edge, void *arg);
+
+/* Highest frequency of the software PWM engine */
+#define GPIO_SOFT_PWM_MAX_FREQUENCY 10000
+
+/**
+ * Timing of the software PWM engine
+ *
+ * Every edge the engine drives is late by the time between when it was due
+ * and when the engine got to it. late_total_ns / edges is the mean lateness
+ * and late_max_ns the worst. missed_periods counts periods skipped because
+ * the engine fell a whole period behind, and errors the pin writes that
+ * failed.
+ */
+typedef struct
+{
+    uint64_t edges;
+    uint64_t late_total_ns;
+    uint64_t late_max_ns;
+    uint64_t missed_periods;
+    uint64_t errors;
+} rpi_gpio_soft_pwm_stats_t;
+
+/**
+ * Queue commands that return nothing instead of waiting for the resource
+ * manager. Once started, rpi_gpio_output, rpi_gpio_set_pwm_duty_cycle,
+ * rpi_gpio_write_mask and batches made only of those return as soon as their
+ * commands are checked and queued. A dedicated I/O thread, with the priority
+ * of the thread calling this function, sends them in order. Every other call
+ * first waits for the commands queued before it, so that a read sees earlier
+ * writes. Failures of queued commands are reported by rpi_gpio_flush.
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NO_RESOURCES       if the I/O thread cannot be started
+ */
+int rpi_gpio_async_start();
+
+/**
+ * Wait until every command queued so far has been sent to the resource
+ * manager.
+ *
+ * @returns  GPIO_SUCCESS                  if every queued command since the previous flush was sent
+ *           otherwise the first failure since the previous flush
+ */
+int rpi_gpio_flush();
+
+/**
+ * Send what is left in the queue, stop the I/O thread and go back to sending
+ * commands from the calling thread. No other thread may be queueing commands
+ * at the time.
+ *
+ * @returns  GPIO_SUCCESS                  if every queued command since the previous flush was sent
+ *           otherwise the first failure since the previous flush
+ */
+int rpi_gpio_async_stop();
+
+/**
+ * Forget the configuration remembered for a pin. The client remembers the
+ * function, pull, PWM set up and duty cycle last sent for every pin, and
+ * skips commands that would not change them; call this after something other
+ * than this process reconfigures the pin.
+ *
+ * @param    gpio_pin  GPIO pin, or GPIO_PIN_ALL for every pin
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number provided
+ */
+int rpi_gpio_invalidate(int gpio_pin);
+
+/**
+ * Choose how threads share connections to the GPIO resource manager. Event
+ * registrations always use the shared connection. A thread's own connection
+ * is closed when the thread exits or by rpi_gpio_cleanup. A thread that cannot
+ * open one uses the shared connection until rpi_gpio_cleanup.
+ *
+ * @param    policy  connection policy (@ref gpio_concurrency_t)
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid policy provided
+ */
+int rpi_gpio_set_concurrency(unsigned policy);
+
+/**
+ * Write and read pin levels directly through the GPIO registers rather than
+ * with messages to the GPIO resource manager. The registers are mapped once;
+ * rpi_gpio_output, rpi_gpio_input, rpi_gpio_write_mask, rpi_gpio_read_all and
+ * batches made only of level writes and reads then cost one or two register
+ * accesses per operation. Everything else still goes to the resource
+ * manager. The process needs the ability to map physical memory.
+ *
+ * @param    peripheral_base  base physical address of the peripherals
+ *                            (RPI_4_PERIPHERALS or RPI_3_PERIPHERALS)
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NOT_MAPPED         if the GPIO registers cannot be mapped
+ */
+int rpi_gpio_enable_direct(uintptr_t peripheral_base);
+
+/**
+ * Go back to writing and reading pin levels through the GPIO resource
+ * manager, and unmap the GPIO registers. No other thread may be using the
+ * API at the time.
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_CLEANING_UP        if the registers cannot be unmapped
+ */
+int rpi_gpio_disable_direct();
+
 /**
  * Select GPIO configuration (input/output)
  *
@@ -189,6 +377,35 @@ int rpi_gpio_output(int gpio_pin, unsigned level);
  */
 int rpi_gpio_input(int gpio_pin, unsigned *level);
 
+/**
+ * Set and clear several pins in one call. Only after rpi_gpio_enable_direct
+ * is this one register write for the pins being set, then one for the pins
+ * being cleared; the two groups do not change at the same instant. Otherwise
+ * every pin in mask takes its own message to the GPIO resource manager.
+ *
+ * @param    mask      pins to change, bit n for GPIO n
+ * @param    levels    new levels of the pins in mask, bit set for high
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NOT_CONNECTED      if the GPIO resource manager not available to connect to
+ *           GPIO_ERROR_MSG_NOT_SENT       if command message is not sent to the GPIO resource manager
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE mask includes pins beyond GPIO_COUNT
+ */
+int rpi_gpio_write_mask(uint32_t mask, uint32_t levels);
+
+/**
+ * Read the levels of every pin in one call. Only after rpi_gpio_enable_direct
+ * is this one register read that samples the pins at the same instant.
+ * Otherwise every pin takes its own message to the GPIO resource manager.
+ *
+ * @param    levels    pin levels (output), bit n set if GPIO n is high
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NOT_CONNECTED      if the GPIO resource manager not available to connect to
+ *           GPIO_ERROR_MSG_NOT_SENT       if command message is not sent to the GPIO resource manager
+ */
+int rpi_gpio_read_all(uint32_t *levels);
+
 /**
  * Report on a GPIO event asynchronously
  *
@@ -206,7 +423,207 @@ int rpi_gpio_input(int gpio_pin, unsigned *level);
 int rpi_gpio_add_event_detect(int gpio_pin, int coid, unsigned event, unsigned event_id);
 
 /**
- * Cleanup GPIO API resources
+ * Start the event dispatcher, a thread that receives the event pulses of
+ * pins enabled with rpi_gpio_event_enable and stamps each with the time it
+ * arrived. rpi_gpio_event_enable starts it at the caller's priority if it is
+ * not running; start it beforehand to choose its priority. Once started, it
+ * runs for the life of the process; starting it again only changes its
+ * priority, if one is given.
+ *
+ * @param    priority  priority of the dispatcher thread under SCHED_FIFO,
+ *                     or 0 for the priority of the calling thread
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NO_RESOURCES       if the dispatcher cannot be started
+ */
+int rpi_gpio_events_start(int priority);
+
+/**
+ * Disable every pin, remove their filters and discard queued edges. Returns
+ * once the dispatcher has finished with edges already received, so no
+ * callback runs after it. The dispatcher keeps running, and pins and edges
+ * stay registered with the resource manager: the resource manager cannot
+ * remove them, so enabling a pin again reuses its registration rather than
+ * receiving every event twice. Call it before rpi_gpio_cleanup, with no
+ * thread waiting for edges, and not from a callback.
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_MSG_NOT_SENT       if the dispatcher cannot be reached
+ */
+int rpi_gpio_events_stop();
+
+/**
+ * Deliver the edges of a pin through the event dispatcher. Without a
+ * callback, edges are queued for rpi_gpio_event_poll and rpi_gpio_event_wait;
+ * with one, the dispatcher thread calls it for every edge instead, so it must
+ * return quickly. A pin is enabled once until rpi_gpio_events_stop.
+ *
+ * @param    gpio_pin  GPIO pin
+ * @param    edges     GPIO_RISING, GPIO_FALLING or both (@ref gpio_level_change_t)
+ * @param    callback  function called for every edge, or NULL to queue them
+ * @param    arg       argument passed to callback
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NOT_CONNECTED      if the GPIO resource manager not available to connect to
+ *           GPIO_ERROR_MSG_NOT_SENT       if the level of a filtered pin cannot be read
+ *           GPIO_ERROR_MSG_EVENT_NOT_REGISTERED if the event cannot be registered
+ *           GPIO_ERROR_NO_RESOURCES       if the dispatcher cannot be started
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number or edges, or the pin is already enabled
+ */
+int rpi_gpio_event_enable(int gpio_pin, unsigned edges, rpi_gpio_edge_callback_t callback, void *arg);
+
+/**
+ * Deliver only the stable transitions of a pin, for switches and sensors
+ * that bounce or pick up glitches. A change of level is reported once the
+ * pin has stayed at the new level for settle_us after its last edge, and for
+ * min_pulse_us after the change began; a pin that returns to its previous
+ * level sooner reports nothing. The reported edge carries the time of the
+ * edge that took the pin to its new level for good. The dispatcher follows
+ * the pin through both edges whatever edges are enabled. Set the filter before rpi_gpio_event_enable;
+ * rpi_gpio_events_stop removes it.
+ *
+ * @param    gpio_pin      GPIO pin
+ * @param    settle_us     time without edges before a change is reported, in microseconds
+ * @param    min_pulse_us  shortest level reported, in microseconds; 0 for both turns the filter off
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number provided, or the pin is already enabled
+ */
+int rpi_gpio_event_set_filter(int gpio_pin, unsigned settle_us, unsigned min_pulse_us);
+
+/**
+ * Take the oldest queued edge of a pin without waiting. Only one thread may
+ * take the edges of a given pin.
+ *
+ * @param    gpio_pin  GPIO pin
+ * @param    edge      edge (output)
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NO_EVENT           if no edge is queued
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number provided
+ */
+int rpi_gpio_event_poll(int gpio_pin, rpi_gpio_edge_t *edge);
+
+/**
+ * Take the oldest queued edge of a pin, waiting for one if there is none.
+ * Only one thread may take the edges of a given pin.
+ *
+ * @param    gpio_pin    GPIO pin
+ * @param    edge        edge (output)
+ * @param    timeout_ms  longest wait in milliseconds, or -1 to wait forever
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NO_EVENT           if no edge arrived in time
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number provided
+ */
+int rpi_gpio_event_wait(int gpio_pin, rpi_gpio_edge_t *edge, int timeout_ms);
+
+/**
+ * Start generating PWM in software, for pins without hardware PWM. One
+ * thread drives every channel: it raises them together at the start of each
+ * period and lowers each at the end of its pulse, with channels that fall at
+ * the same time lowered in one write. It waits for each edge on the
+ * monotonic clock in absolute time and spins through the last clock tick
+ * (ClockPeriod) before it, as timers only fire on a tick. A period must be at
+ * least two ticks long, so the default 1 ms tick allows up to about 490 Hz;
+ * a shorter tick allows more, up to GPIO_SOFT_PWM_MAX_FREQUENCY. Enable the
+ * direct register path with rpi_gpio_enable_direct for the most precise
+ * edges; queued commands (rpi_gpio_async_start) would delay them. If the
+ * engine is already running, only its frequency changes.
+ *
+ * @param    frequency  PWM frequency in Hz, shared by every channel
+ * @param    priority   priority of the engine thread under SCHED_FIFO,
+ *                      or 0 for the priority of the calling thread
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NO_RESOURCES       if the clock tick cannot be read or the thread cannot be started
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE frequency is 0, above GPIO_SOFT_PWM_MAX_FREQUENCY, or has a period
+ *                                         shorter than two clock ticks
+ */
+int rpi_gpio_soft_pwm_start(unsigned frequency, int priority);
+
+/**
+ * Stop the software PWM engine and leave every channel low.
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           otherwise the status of the write that lowers the channels
+ */
+int rpi_gpio_soft_pwm_stop();
+
+/**
+ * Set the duty cycle of a software PWM channel. The first call for a pin
+ * makes it an output and adds it to the engine; a new duty cycle takes
+ * effect at the start of the next period.
+ *
+ * @param    gpio_pin    GPIO pin
+ * @param    percentage  percentage of the period when the pin is high
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_NOT_CONNECTED      if the GPIO resource manager not available to connect to
+ *           GPIO_ERROR_MSG_NOT_SENT       if command message is not sent to the GPIO resource manager
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE invalid pin number or percentage provided
+ */
+int rpi_gpio_soft_pwm_set_duty_cycle(int gpio_pin, float percentage);
+
+/**
+ * Read the timing statistics of the software PWM engine
+ *
+ * @param    stats  statistics since the last reset (output)
+ * @param    reset  whether to start counting afresh
+ *
+ * @returns  GPIO_SUCCESS                  on success
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE stats is NULL
+ */
+int rpi_gpio_soft_pwm_get_stats(rpi_gpio_soft_pwm_stats_t *stats, bool reset);
+
+/**
+ * Empty a batch
+ *
+ * @param    batch  batch of operations
+ */
+void rpi_gpio_batch_init(rpi_gpio_batch_t *batch);
+
+/**
+ * Add an operation to a batch. The arguments are those of the matching
+ * single-operation function (rpi_gpio_setup, rpi_gpio_setup_pull without the
+ * configuration, rpi_gpio_output, rpi_gpio_input, rpi_gpio_setup_pwm,
+ * rpi_gpio_set_pwm_duty_cycle, rpi_gpio_write_mask and rpi_gpio_read_all).
+ * Arguments are checked when the batch is submitted.
+ *
+ * @param    batch  batch of operations
+ *
+ * @returns  index of the operation in batch->ops on success
+ *           GPIO_ERROR_INPUT_OUT_OF_RANGE if the batch already holds GPIO_BATCH_MAX operations
+ */
+int rpi_gpio_batch_add_setup(rpi_gpio_batch_t *batch, int gpio_pin, unsigned configuration);
+int rpi_gpio_batch_add_pull(rpi_gpio_batch_t *batch, int gpio_pin, unsigned direction);
+int rpi_gpio_batch_add_output(rpi_gpio_batch_t *batch, int gpio_pin, unsigned level);
+int rpi_gpio_batch_add_input(rpi_gpio_batch_t *batch, int gpio_pin);
+int rpi_gpio_batch_add_setup_pwm(rpi_gpio_batch_t *batch, int gpio_pin, unsigned frequency, unsigned mode);
+int rpi_gpio_batch_add_pwm_duty_cycle(rpi_gpio_batch_t *batch, int gpio_pin, float percentage);
+int rpi_gpio_batch_add_write_mask(rpi_gpio_batch_t *batch, uint32_t mask, uint32_t levels);
+int rpi_gpio_batch_add_read_all(rpi_gpio_batch_t *batch);
+
+/**
+ * Run the operations of a batch in order. Every operation is attempted and
+ * gets its own status; levels read by GPIO_OP_INPUT operations are stored in
+ * their value field. Batching is done by the client only: the resource
+ * manager has no batch message, so operations that go to it are still sent
+ * one message each. A batch saves messages where its operations run on the
+ * mapped registers (rpi_gpio_enable_direct), are queued
+ * (rpi_gpio_async_start) or would not change the pin.
+ *
+ * @param    batch  batch of operations
+ *
+ * @returns  GPIO_SUCCESS                  if every operation succeeded
+ *           GPIO_ERROR_NOT_CONNECTED      if the GPIO resource manager not available to connect to
+ *           otherwise the status of the first failed operation
+ */
+int rpi_gpio_batch_submit(rpi_gpio_batch_t *batch);
+
+/**
+ * Cleanup GPIO API resources: disconnect from the resource manager and unmap
+ * the GPIO registers
  *
  * @returns  GPIO_SUCCESS                  on success
  *           GPIO_ERROR_NOT_CONNECTED      if resource manager not available to connect to
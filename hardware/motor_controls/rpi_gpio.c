@@ -14,34 +14,135 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/neutrino.h>
+#include <unistd.h>
 #include "public/rpi_gpio.h"
 
-// File descriptor to communicate with resource manager
-static int gpio_fd = -1;
+// File descriptor to communicate with resource manager, -1 until connected.
+// It only changes under gpio_fd_mutex, so once set it can be read without it.
+static atomic_int gpio_fd = -1;
 
-// Mutex protecting the GPIO message file descriptor
-static pthread_mutex_t gpio_fd_mutex;
+// Mutex serialising connection setup and teardown, and messages on the file
+// descriptor under GPIO_CONCURRENCY_SERIALISED
+static pthread_mutex_t gpio_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// How threads share connections to the resource manager (@ref gpio_concurrency_t)
+static atomic_uint gpio_concurrency = GPIO_CONCURRENCY_SHARED;
+
+// A connection of one thread's own, under GPIO_CONCURRENCY_PER_THREAD. A
+// thread whose connection failed to open uses the shared one until
+// rpi_gpio_cleanup.
+typedef struct gpio_thread_conn
+{
+    atomic_int fd;
+    atomic_bool failed;
+    struct gpio_thread_conn *next;
+} gpio_thread_conn_t;
+
+// Connections of every thread, so that rpi_gpio_cleanup can close them;
+// protected by gpio_fd_mutex
+static gpio_thread_conn_t *gpio_thread_conns;
+
+// This thread's connection. It is also stored under gpio_thread_key, whose
+// destructor closes it when the thread exits.
+static _Thread_local gpio_thread_conn_t *gpio_thread_conn;
+static pthread_key_t gpio_thread_key;
+static pthread_once_t gpio_thread_key_once = PTHREAD_ONCE_INIT;
+
+// Mapped GPIO registers, used by the inline accessors in aarch64/rpi_gpio.h
+uint32_t volatile *rpi_gpio_regs;
+
+// Whether level writes and reads go straight to the mapped registers
+static atomic_bool gpio_direct = false;
+
+// Pins that can be written or read through a mask
+#define GPIO_ALL_PINS ((1u << GPIO_COUNT) - 1)
+
+// Commands on several pins at once. The resource manager has no message for
+// them: they run on the mapped registers, or as one message per pin. Their
+// numbers are kept clear of the resource manager's subtypes.
+enum
+{
+    GPIO_CMD_WRITE_MASK = 0x1000,
+    GPIO_CMD_READ_ALL
+};
+
+// One command for the resource manager or the mapped registers. subtype is
+// an RPI_GPIO_* message subtype or a GPIO_CMD_* command; gpio and value are
+// used as in rpi_gpio_msg_t, with value holding the mode for
+// RPI_GPIO_PWM_SETUP and gpio the mask of pins for GPIO_CMD_WRITE_MASK.
+// status receives the errno value of the command (EOK on success).
+typedef struct
+{
+    unsigned subtype;
+    unsigned gpio;
+    unsigned value;
+    unsigned frequency;
+    unsigned range;
+    int status;
+} gpio_cmd_t;
+
+// Client-side copy of the configuration of a pin, as last sent to the
+// resource manager, so that commands that would not change it are skipped
+typedef struct
+{
+    bool function_known;
+    unsigned function;
+    bool pull_known;
+    unsigned pull;
+    bool pwm_known;
+    unsigned frequency;
+    unsigned range;
+    unsigned mode;
+    bool duty_known;
+    unsigned duty;
+} gpio_shadow_t;
+
+// Configuration of every pin; protected by gpio_shadow_mutex
+static gpio_shadow_t gpio_shadow[GPIO_COUNT];
+static pthread_mutex_t gpio_shadow_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Held from a configuration command's shadow check until the command has been
+// sent or queued, so that threads configuring the same pin send their
+// commands in the order they updated the shadow. Taken before
+// gpio_shadow_mutex, and only by calls that configure pins.
+static pthread_mutex_t gpio_config_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 // Connect to the GPIO resource manager
 static int gpio_msg_connect()
 {
     int status = GPIO_SUCCESS;
 
+    // Already connected: a single load, no lock
+    if (atomic_load_explicit(&gpio_fd, memory_order_relaxed) != -1)
+    {
+        return GPIO_SUCCESS;
+    }
+
     pthread_mutex_lock(&gpio_fd_mutex);
 
-    if (gpio_fd == -1)
+    // Another thread may have connected while this one waited for the lock.
+    // A failed open is retried by the next call.
+    if (atomic_load_explicit(&gpio_fd, memory_order_relaxed) == -1)
     {
-        gpio_fd = open("/dev/gpio/msg", O_RDWR);
-        if (gpio_fd == -1)
+        int fd = open("/dev/gpio/msg", O_RDWR);
+        if (fd == -1)
         {
             perror("open");
             status = GPIO_ERROR_NOT_CONNECTED;
         }
+        else
+        {
+            atomic_store_explicit(&gpio_fd, fd, memory_order_relaxed);
+        }
     }
 
     pthread_mutex_unlock(&gpio_fd_mutex);
@@ -49,15 +150,131 @@ static int gpio_msg_connect()
     return status;
 }
 
-// Send a message to the GPIO resource manager
-static int gpio_send_msg(void *buffer, size_t buffer_size)
+// Close a thread's connection when the thread exits
+static void gpio_thread_conn_destroy(void *value)
 {
+    gpio_thread_conn_t *conn = value;
+
     pthread_mutex_lock(&gpio_fd_mutex);
 
-    int status = MsgSend(gpio_fd, buffer, buffer_size, NULL, 0);
+    gpio_thread_conn_t **link = &gpio_thread_conns;
+    while (*link != conn)
+    {
+        link = &(*link)->next;
+    }
+    *link = conn->next;
+
+    int fd = atomic_exchange_explicit(&conn->fd, -1, memory_order_relaxed);
+    if (fd != -1)
+    {
+        close(fd);
+    }
 
     pthread_mutex_unlock(&gpio_fd_mutex);
 
+    free(conn);
+}
+
+static void gpio_thread_key_create()
+{
+    pthread_key_create(&gpio_thread_key, gpio_thread_conn_destroy);
+}
+
+// Open this thread's own connection to the GPIO resource manager
+static int gpio_thread_connect()
+{
+    gpio_thread_conn_t *conn = gpio_thread_conn;
+
+    if (conn == NULL)
+    {
+        pthread_once(&gpio_thread_key_once, gpio_thread_key_create);
+
+        conn = malloc(sizeof(*conn));
+        if (conn == NULL)
+        {
+            return -1;
+        }
+        atomic_init(&conn->fd, -1);
+        atomic_init(&conn->failed, false);
+
+        pthread_mutex_lock(&gpio_fd_mutex);
+        conn->next = gpio_thread_conns;
+        gpio_thread_conns = conn;
+        pthread_mutex_unlock(&gpio_fd_mutex);
+
+        gpio_thread_conn = conn;
+        pthread_setspecific(gpio_thread_key, conn);
+    }
+
+    if (atomic_load_explicit(&conn->failed, memory_order_relaxed))
+    {
+        return -1;
+    }
+
+    int fd = open("/dev/gpio/msg", O_RDWR);
+    if (fd == -1)
+    {
+        perror("open");
+        atomic_store_explicit(&conn->failed, true, memory_order_relaxed);
+        return -1;
+    }
+
+    pthread_mutex_lock(&gpio_fd_mutex);
+    atomic_store_explicit(&conn->fd, fd, memory_order_relaxed);
+    pthread_mutex_unlock(&gpio_fd_mutex);
+
+    return fd;
+}
+
+// Pick the connection for a message from this thread, taking gpio_fd_mutex if
+// messages are serialised. Set shared for messages that must use the shared
+// connection whatever the policy.
+static int gpio_conn_acquire(bool shared, bool *locked)
+{
+    unsigned policy = atomic_load_explicit(&gpio_concurrency, memory_order_relaxed);
+
+    *locked = false;
+    if (policy == GPIO_CONCURRENCY_SERIALISED)
+    {
+        pthread_mutex_lock(&gpio_fd_mutex);
+        *locked = true;
+    }
+    else if (policy == GPIO_CONCURRENCY_PER_THREAD && !shared)
+    {
+        gpio_thread_conn_t *conn = gpio_thread_conn;
+        int fd = (conn != NULL) ? atomic_load_explicit(&conn->fd, memory_order_relaxed) : -1;
+        if (fd == -1)
+        {
+            fd = gpio_thread_connect();
+        }
+        // Fall back to the shared connection if this thread cannot have its own
+        if (fd != -1)
+        {
+            return fd;
+        }
+    }
+
+    return atomic_load_explicit(&gpio_fd, memory_order_relaxed);
+}
+
+static void gpio_conn_release(bool locked)
+{
+    if (locked)
+    {
+        pthread_mutex_unlock(&gpio_fd_mutex);
+    }
+}
+
+// Send a message to the GPIO resource manager
+static int gpio_send_msg(void *buffer, size_t buffer_size)
+{
+    bool locked;
+    int fd = gpio_conn_acquire(false, &locked);
+
+    int status = MsgSend(fd, buffer, buffer_size, NULL, 0);
+
+    gpio_conn_release(locked);
+
     if (status != GPIO_SUCCESS)
     {
         perror("MsgSend");
@@ -70,11 +287,12 @@ static int gpio_send_msg(void *buffer, size_t buffer_size)
 // Send a message to the GPIO resource manager and receive a reply in the same buffer
 static int gpio_send_receive_msg(void *buffer, size_t buffer_size)
 {
-    pthread_mutex_lock(&gpio_fd_mutex);
+    bool locked;
+    int fd = gpio_conn_acquire(false, &locked);
 
-    int status = MsgSend(gpio_fd, buffer, buffer_size, buffer, buffer_size);
+    int status = MsgSend(fd, buffer, buffer_size, buffer, buffer_size);
 
-    pthread_mutex_unlock(&gpio_fd_mutex);
+    gpio_conn_release(locked);
 
     if (status != GPIO_SUCCESS)
     {
@@ -82,41 +300,945 @@ static int gpio_send_receive_msg(void *buffer, size_t buffer_size)
         return GPIO_ERROR_MSG_NOT_SENT;
     }
 
-    return GPIO_SUCCESS;
+    return GPIO_SUCCESS;
+}
+
+// Register an event with the GPIO resource manager and send the request for
+// it. Both go over the shared connection, which outlives the calling thread.
+static int gpio_msg_register_event(rpi_gpio_event_t *event_msg)
+{
+    bool locked;
+    int fd = gpio_conn_acquire(true, &locked);
+
+    int status = MsgRegisterEvent(&event_msg->event, fd);
+    if (status != GPIO_SUCCESS)
+    {
+        gpio_conn_release(locked);
+        perror("MsgRegisterEvent");
+        return GPIO_ERROR_MSG_EVENT_NOT_REGISTERED;
+    }
+
+    status = MsgSend(fd, event_msg, sizeof(*event_msg), NULL, 0);
+
+    gpio_conn_release(locked);
+
+    if (status != GPIO_SUCCESS)
+    {
+        perror("MsgSend");
+        return GPIO_ERROR_MSG_NOT_SENT;
+    }
+
+    return GPIO_SUCCESS;
+}
+
+// Check an operation and translate it into a resource manager command
+static int gpio_op_encode(const rpi_gpio_op_t *op, gpio_cmd_t *cmd)
+{
+    bool all_pins = (op->op == GPIO_OP_WRITE_MASK || op->op == GPIO_OP_READ_ALL);
+
+    if (!all_pins && (op->gpio_pin < 0 || op->gpio_pin >= GPIO_COUNT))
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    memset(cmd, 0, sizeof(*cmd));
+    cmd->gpio = op->gpio_pin;
+
+    switch (op->op)
+    {
+    case GPIO_OP_SETUP:
+        cmd->subtype = RPI_GPIO_SET_SELECT;
+        if (op->value == GPIO_IN)
+        {
+            cmd->value = RPI_GPIO_FUNC_IN;
+        }
+        else if (op->value == GPIO_OUT)
+        {
+            cmd->value = RPI_GPIO_FUNC_OUT;
+        }
+        else
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        break;
+
+    case GPIO_OP_PULL:
+        cmd->subtype = RPI_GPIO_PUD;
+        if (op->value == GPIO_PUD_OFF)
+        {
+            cmd->value = RPI_GPIO_PUD_OFF;
+        }
+        else if (op->value == GPIO_PUD_UP)
+        {
+            cmd->value = RPI_GPIO_PUD_UP;
+        }
+        else if (op->value == GPIO_PUD_DOWN)
+        {
+            cmd->value = RPI_GPIO_PUD_DOWN;
+        }
+        else
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        break;
+
+    case GPIO_OP_OUTPUT:
+        cmd->subtype = RPI_GPIO_WRITE;
+        if (op->value == GPIO_LOW)
+        {
+            cmd->value = 0;
+        }
+        else if (op->value == GPIO_HIGH)
+        {
+            cmd->value = 1;
+        }
+        else
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        break;
+
+    case GPIO_OP_INPUT:
+        cmd->subtype = RPI_GPIO_READ;
+        cmd->value = 1;
+        break;
+
+    case GPIO_OP_SETUP_PWM:
+        cmd->subtype = RPI_GPIO_PWM_SETUP;
+        cmd->frequency = op->frequency;
+        cmd->range = 1024;
+        if (op->value == GPIO_PWM_MODE_PWM)
+        {
+            cmd->value = RPI_PWM_MODE_PWM;
+        }
+        else if (op->value == GPIO_PWM_MODE_MS)
+        {
+            cmd->value = RPI_PWM_MODE_MS;
+        }
+        else
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        break;
+
+    case GPIO_OP_PWM_DUTY:
+        if (op->percentage < 0.0 || op->percentage > 100.0)
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        cmd->subtype = RPI_GPIO_PWM_DUTY;
+        cmd->value = (int)(op->percentage * 1024.0 / 100.0);
+        break;
+
+    case GPIO_OP_WRITE_MASK:
+        if (op->mask & ~GPIO_ALL_PINS)
+        {
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+        cmd->subtype = GPIO_CMD_WRITE_MASK;
+        cmd->gpio = op->mask;
+        cmd->value = op->value & op->mask;
+        break;
+
+    case GPIO_OP_READ_ALL:
+        cmd->subtype = GPIO_CMD_READ_ALL;
+        cmd->gpio = 0;
+        break;
+
+    default:
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    return GPIO_SUCCESS;
+}
+
+// Store the result of a command in its operation
+static int gpio_op_decode(rpi_gpio_op_t *op, const gpio_cmd_t *cmd)
+{
+    if (cmd->status != EOK)
+    {
+        return (cmd->status == EINVAL) ? GPIO_ERROR_INPUT_OUT_OF_RANGE : GPIO_ERROR_MSG_NOT_SENT;
+    }
+
+    if (op->op == GPIO_OP_INPUT)
+    {
+        switch (cmd->value)
+        {
+        case 0:
+            op->value = GPIO_LOW;
+            break;
+
+        case 1:
+            op->value = GPIO_HIGH;
+            break;
+
+        default:
+            return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        }
+    }
+    else if (op->op == GPIO_OP_READ_ALL)
+    {
+        op->value = cmd->value & GPIO_ALL_PINS;
+    }
+
+    return GPIO_SUCCESS;
+}
+
+// Number of commands the asynchronous queue holds
+#define GPIO_ASYNC_QUEUE_SIZE 256
+
+// Pulse code waking the I/O thread
+#define GPIO_ASYNC_PULSE_WAKE (_PULSE_CODE_MINAVAIL + 1)
+
+// One position of the asynchronous queue. Its sequence is the position it
+// can next be claimed at, plus one once the command in it is ready.
+typedef struct
+{
+    atomic_uint sequence;
+    gpio_cmd_t cmd;
+} gpio_async_slot_t;
+
+// Queue of commands waiting for the I/O thread
+static gpio_async_slot_t gpio_async_slots[GPIO_ASYNC_QUEUE_SIZE];
+
+// Next position threads adding commands claim
+static atomic_uint gpio_async_tail;
+
+// Next position the I/O thread takes; only used by the I/O thread
+static unsigned gpio_async_head;
+
+// Positions sent so far
+static atomic_uint gpio_async_done;
+
+// Whether commands are queued rather than sent by the calling thread
+static atomic_bool gpio_async_running = false;
+
+// Whether the I/O thread is, or is about to be, waiting for a pulse
+static atomic_bool gpio_async_sleeping = false;
+
+// First failure since the last rpi_gpio_flush
+static atomic_int gpio_async_error = GPIO_SUCCESS;
+
+// Threads waiting for gpio_async_done to move, woken through gpio_async_cond
+static atomic_int gpio_async_waiters;
+static pthread_mutex_t gpio_async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gpio_async_cond = PTHREAD_COND_INITIALIZER;
+
+// The I/O thread and the channel it receives pulses on
+static pthread_t gpio_async_tid;
+static int gpio_async_chid = -1;
+static int gpio_async_coid = -1;
+
+// Whether a command is tracked in the pin's shadow
+static bool gpio_shadow_tracked(const gpio_cmd_t *cmd)
+{
+    switch (cmd->subtype)
+    {
+    case RPI_GPIO_SET_SELECT:
+    case RPI_GPIO_PUD:
+    case RPI_GPIO_PWM_SETUP:
+    case RPI_GPIO_PWM_DUTY:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Check a tracked command against the pin's shadow. Returns true if it would not
+// change anything; otherwise records its effect and returns false. Commands
+// are checked in the order they are sent, so a batch that reconfigures a pin
+// twice sees its own changes.
+static bool gpio_shadow_apply(const gpio_cmd_t *cmd)
+{
+    bool redundant = false;
+
+    pthread_mutex_lock(&gpio_shadow_mutex);
+
+    gpio_shadow_t *shadow = &gpio_shadow[cmd->gpio];
+    switch (cmd->subtype)
+    {
+    case RPI_GPIO_SET_SELECT:
+        redundant = shadow->function_known && shadow->function == cmd->value;
+        shadow->function_known = true;
+        shadow->function = cmd->value;
+        if (!redundant)
+        {
+            // Leaving the PWM function loses the PWM set up
+            shadow->pwm_known = false;
+            shadow->duty_known = false;
+        }
+        break;
+
+    case RPI_GPIO_PUD:
+        redundant = shadow->pull_known && shadow->pull == cmd->value;
+        shadow->pull_known = true;
+        shadow->pull = cmd->value;
+        break;
+
+    case RPI_GPIO_PWM_SETUP:
+        redundant = shadow->pwm_known && shadow->frequency == cmd->frequency && shadow->range == cmd->range &&
+                    shadow->mode == cmd->value;
+        if (!redundant)
+        {
+            // The resource manager picks the pin's PWM function and may reset the duty cycle
+            shadow->pwm_known = true;
+            shadow->frequency = cmd->frequency;
+            shadow->range = cmd->range;
+            shadow->mode = cmd->value;
+            shadow->function_known = false;
+            shadow->duty_known = false;
+        }
+        break;
+
+    case RPI_GPIO_PWM_DUTY:
+        redundant = shadow->duty_known && shadow->duty == cmd->value;
+        shadow->duty_known = true;
+        shadow->duty = cmd->value;
+        break;
+    }
+
+    pthread_mutex_unlock(&gpio_shadow_mutex);
+
+    return redundant;
+}
+
+// Forget what a failed command may have changed
+static void gpio_shadow_forget(const gpio_cmd_t *cmd)
+{
+    switch (cmd->subtype)
+    {
+    case RPI_GPIO_SET_SELECT:
+    case RPI_GPIO_PWM_SETUP:
+        pthread_mutex_lock(&gpio_shadow_mutex);
+        gpio_shadow[cmd->gpio].function_known = false;
+        gpio_shadow[cmd->gpio].pwm_known = false;
+        gpio_shadow[cmd->gpio].duty_known = false;
+        pthread_mutex_unlock(&gpio_shadow_mutex);
+        break;
+
+    case RPI_GPIO_PUD:
+        pthread_mutex_lock(&gpio_shadow_mutex);
+        gpio_shadow[cmd->gpio].pull_known = false;
+        pthread_mutex_unlock(&gpio_shadow_mutex);
+        break;
+
+    case RPI_GPIO_PWM_DUTY:
+        pthread_mutex_lock(&gpio_shadow_mutex);
+        gpio_shadow[cmd->gpio].duty_known = false;
+        pthread_mutex_unlock(&gpio_shadow_mutex);
+        break;
+    }
+}
+
+// Run a mask command as one message per pin
+static void gpio_send_mask_cmd(gpio_cmd_t *cmd)
+{
+    unsigned levels = 0;
+    cmd->status = EOK;
+    for (unsigned pin = 0; pin < GPIO_COUNT; pin++)
+    {
+        rpi_gpio_msg_t msg = {
+            .hdr.type = _IO_MSG,
+            .hdr.mgrid = RPI_GPIO_IOMGR,
+            .gpio = pin};
+        int status;
+
+        if (cmd->subtype == GPIO_CMD_WRITE_MASK)
+        {
+            if ((cmd->gpio & (1u << pin)) == 0)
+            {
+                continue;
+            }
+            msg.hdr.subtype = RPI_GPIO_WRITE;
+            msg.value = (cmd->value >> pin) & 1;
+            status = gpio_send_msg(&msg, sizeof(msg));
+        }
+        else
+        {
+            msg.hdr.subtype = RPI_GPIO_READ;
+            msg.value = 1;
+            status = gpio_send_receive_msg(&msg, sizeof(msg));
+            levels |= (msg.value & 1) << pin;
+        }
+
+        if (status != GPIO_SUCCESS)
+        {
+            cmd->status = EIO;
+        }
+    }
+
+    if (cmd->subtype == GPIO_CMD_READ_ALL)
+    {
+        cmd->value = levels;
+    }
+}
+
+// Send one command to the resource manager as its own message
+static void gpio_send_cmd(gpio_cmd_t *cmd)
+{
+    if (cmd->subtype == GPIO_CMD_WRITE_MASK || cmd->subtype == GPIO_CMD_READ_ALL)
+    {
+        gpio_send_mask_cmd(cmd);
+        return;
+    }
+
+    if (cmd->subtype == RPI_GPIO_PWM_SETUP)
+    {
+        rpi_gpio_pwm_t pwm_msg = {
+            .hdr.type = _IO_MSG,
+            .hdr.subtype = RPI_GPIO_PWM_SETUP,
+            .hdr.mgrid = RPI_GPIO_IOMGR,
+            .gpio = cmd->gpio,
+            .frequency = cmd->frequency,
+            .range = cmd->range,
+            .mode = cmd->value};
+
+        cmd->status = gpio_send_msg(&pwm_msg, sizeof(pwm_msg)) ? EIO : EOK;
+        return;
+    }
+
+    rpi_gpio_msg_t msg = {
+        .hdr.type = _IO_MSG,
+        .hdr.subtype = cmd->subtype,
+        .hdr.mgrid = RPI_GPIO_IOMGR,
+        .gpio = cmd->gpio,
+        .value = cmd->value};
+
+    if (cmd->subtype == RPI_GPIO_READ)
+    {
+        cmd->status = gpio_send_receive_msg(&msg, sizeof(msg)) ? EIO : EOK;
+        cmd->value = msg.value;
+    }
+    else
+    {
+        cmd->status = gpio_send_msg(&msg, sizeof(msg)) ? EIO : EOK;
+    }
+}
+
+// Whether commands can all run on the mapped registers
+static bool gpio_direct_capable(const gpio_cmd_t *cmds, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        switch (cmds[i].subtype)
+        {
+        case RPI_GPIO_WRITE:
+        case RPI_GPIO_READ:
+        case GPIO_CMD_WRITE_MASK:
+        case GPIO_CMD_READ_ALL:
+            break;
+
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Run level writes and reads on the mapped registers, one access each (two
+// for a mask that both sets and clears pins)
+static void gpio_run_direct(gpio_cmd_t *cmds, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        switch (cmds[i].subtype)
+        {
+        case RPI_GPIO_WRITE:
+            rpi_gpio_write(cmds[i].gpio, cmds[i].value);
+            break;
+
+        case RPI_GPIO_READ:
+            cmds[i].value = rpi_gpio_read(cmds[i].gpio);
+            break;
+
+        case GPIO_CMD_WRITE_MASK:
+        {
+            // All pins in GPIO_ALL_PINS are in bank 0
+            uint32_t const set = cmds[i].gpio & cmds[i].value;
+            uint32_t const clear = cmds[i].gpio & ~cmds[i].value;
+            if (set)
+            {
+                __RPI_GPIO_REGS[RPI_GPIO_REG_GPSET0] = set;
+            }
+            if (clear)
+            {
+                __RPI_GPIO_REGS[RPI_GPIO_REG_GPCLR0] = clear;
+            }
+            break;
+        }
+
+        case GPIO_CMD_READ_ALL:
+            cmds[i].value = __RPI_GPIO_REGS[RPI_GPIO_REG_GPLEV0];
+            break;
+        }
+        cmds[i].status = EOK;
+    }
+}
+
+// Send commands to the resource manager in order, one message each; the
+// resource manager has no message that carries several. Commands that fail
+// are forgotten by the shadow.
+static void gpio_send_cmds(gpio_cmd_t *cmds, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        gpio_send_cmd(&cmds[i]);
+        if (cmds[i].status != EOK)
+        {
+            gpio_shadow_forget(&cmds[i]);
+        }
+    }
+}
+
+// Whether a command can be queued: it must not return anything
+static bool gpio_async_capable(const gpio_cmd_t *cmd)
+{
+    return cmd->subtype == RPI_GPIO_WRITE || cmd->subtype == GPIO_CMD_WRITE_MASK ||
+           cmd->subtype == RPI_GPIO_PWM_DUTY;
+}
+
+// Wake the I/O thread if it is waiting for commands
+static void gpio_async_wake()
+{
+    // The queued command must be visible before the I/O thread's state is read
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&gpio_async_sleeping, false))
+    {
+        MsgSendPulse(gpio_async_coid, -1, GPIO_ASYNC_PULSE_WAKE, 0);
+    }
+}
+
+// Wait for the I/O thread to free the slot of a full queue that position pos
+// goes in. The thread is woken first, as the commands filling the queue may
+// not have been announced yet.
+static void gpio_async_wait_slot(unsigned pos)
+{
+    unsigned target = pos - GPIO_ASYNC_QUEUE_SIZE + 1;
+
+    atomic_fetch_add(&gpio_async_waiters, 1);
+    gpio_async_wake();
+    pthread_mutex_lock(&gpio_async_mutex);
+    while ((int)(atomic_load(&gpio_async_done) - target) < 0)
+    {
+        pthread_cond_wait(&gpio_async_cond, &gpio_async_mutex);
+    }
+    pthread_mutex_unlock(&gpio_async_mutex);
+    atomic_fetch_sub(&gpio_async_waiters, 1);
+}
+
+// Claim the next position of the queue and store a command in it. Several
+// threads may add commands at once; a full queue makes them sleep until the
+// I/O thread has sent what is in the way, rather than spin, which would keep
+// a lower-priority I/O thread from ever running.
+static void gpio_async_push(const gpio_cmd_t *cmd)
+{
+    unsigned pos = atomic_load_explicit(&gpio_async_tail, memory_order_relaxed);
+    gpio_async_slot_t *slot;
+
+    for (;;)
+    {
+        slot = &gpio_async_slots[pos % GPIO_ASYNC_QUEUE_SIZE];
+        int diff = (int)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&gpio_async_tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else
+        {
+            if (diff < 0)
+            {
+                gpio_async_wait_slot(pos);
+            }
+            pos = atomic_load_explicit(&gpio_async_tail, memory_order_relaxed);
+        }
+    }
+
+    slot->cmd = *cmd;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+}
+
+// Take the oldest command off the queue; only called by the I/O thread
+static bool gpio_async_pop(gpio_cmd_t *cmd)
+{
+    gpio_async_slot_t *slot = &gpio_async_slots[gpio_async_head % GPIO_ASYNC_QUEUE_SIZE];
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != gpio_async_head + 1)
+    {
+        return false;
+    }
+
+    *cmd = slot->cmd;
+    atomic_store_explicit(&slot->sequence, gpio_async_head + GPIO_ASYNC_QUEUE_SIZE, memory_order_release);
+    gpio_async_head++;
+
+    return true;
+}
+
+// Wait until every command queued so far has been sent
+static void gpio_async_wait()
+{
+    unsigned target = atomic_load(&gpio_async_tail);
+
+    if ((int)(atomic_load(&gpio_async_done) - target) >= 0)
+    {
+        return;
+    }
+
+    atomic_fetch_add(&gpio_async_waiters, 1);
+    pthread_mutex_lock(&gpio_async_mutex);
+    while ((int)(atomic_load(&gpio_async_done) - target) < 0)
+    {
+        pthread_cond_wait(&gpio_async_cond, &gpio_async_mutex);
+    }
+    pthread_mutex_unlock(&gpio_async_mutex);
+    atomic_fetch_sub(&gpio_async_waiters, 1);
+}
+
+// I/O thread: sends queued commands in order and sleeps on a pulse when the
+// queue is empty
+static void *gpio_async_thread(void *arg)
+{
+    gpio_cmd_t cmds[GPIO_BATCH_MAX];
+    struct _pulse pulse;
+
+    (void)arg;
+
+    for (;;)
+    {
+        unsigned count = 0;
+        while (count < GPIO_BATCH_MAX && gpio_async_pop(&cmds[count]))
+        {
+            count++;
+        }
+
+        if (count > 0)
+        {
+            int status = GPIO_SUCCESS;
+            if (gpio_msg_connect())
+            {
+                status = GPIO_ERROR_NOT_CONNECTED;
+                for (unsigned i = 0; i < count; i++)
+                {
+                    gpio_shadow_forget(&cmds[i]);
+                }
+            }
+            else
+            {
+                gpio_send_cmds(cmds, count);
+                for (unsigned i = 0; i < count && status == GPIO_SUCCESS; i++)
+                {
+                    if (cmds[i].status != EOK)
+                    {
+                        status = GPIO_ERROR_MSG_NOT_SENT;
+                    }
+                }
+            }
+
+            // Keep the first failure for rpi_gpio_flush
+            int expected = GPIO_SUCCESS;
+            if (status != GPIO_SUCCESS)
+            {
+                atomic_compare_exchange_strong(&gpio_async_error, &expected, status);
+            }
+
+            atomic_store(&gpio_async_done, gpio_async_head);
+            if (atomic_load(&gpio_async_waiters) > 0)
+            {
+                pthread_mutex_lock(&gpio_async_mutex);
+                pthread_cond_broadcast(&gpio_async_cond);
+                pthread_mutex_unlock(&gpio_async_mutex);
+            }
+            continue;
+        }
+
+        if (!atomic_load(&gpio_async_running))
+        {
+            break;
+        }
+
+        // Announce the sleep before the last look at the queue, so that a
+        // command added in between either is seen or sends a pulse
+        atomic_store(&gpio_async_sleeping, true);
+        gpio_async_slot_t *slot = &gpio_async_slots[gpio_async_head % GPIO_ASYNC_QUEUE_SIZE];
+        if (atomic_load(&slot->sequence) == gpio_async_head + 1 || !atomic_load(&gpio_async_running))
+        {
+            atomic_store(&gpio_async_sleeping, false);
+            continue;
+        }
+
+        if (MsgReceivePulse(gpio_async_chid, &pulse, sizeof(pulse), NULL) == -1)
+        {
+            perror("MsgReceivePulse");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Run operations in order: invalid ones fail on their own, and ones that
+// would not change the pin's configuration succeed without being sent. The
+// rest run on the mapped registers if direct access is enabled and they are
+// all level writes and reads; are queued for the I/O thread if the
+// asynchronous queue is running and none of them returns anything; and
+// otherwise go to the resource manager once everything queued has been sent.
+// Operations that configure a pin hold gpio_config_mutex until they are sent
+// or queued. Returns the first failure.
+static int gpio_run_ops(rpi_gpio_op_t *ops, unsigned count)
+{
+    gpio_cmd_t cmds[GPIO_BATCH_MAX];
+    unsigned cmd_op[GPIO_BATCH_MAX];
+    unsigned cmd_count = 0;
+    int status = GPIO_SUCCESS;
+    bool configuring = false;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        ops[i].status = gpio_op_encode(&ops[i], &cmds[cmd_count]);
+        if (ops[i].status != GPIO_SUCCESS)
+        {
+            continue;
+        }
+
+        if (gpio_shadow_tracked(&cmds[cmd_count]))
+        {
+            if (!configuring)
+            {
+                pthread_mutex_lock(&gpio_config_mutex);
+                configuring = true;
+            }
+            if (gpio_shadow_apply(&cmds[cmd_count]))
+            {
+                continue;
+            }
+        }
+        cmd_op[cmd_count++] = i;
+    }
+
+    bool sent = false;
+    bool async = atomic_load_explicit(&gpio_async_running, memory_order_relaxed);
+
+    // Acquire pairs with rpi_gpio_enable_direct, so the mapping is seen with the flag
+    if (atomic_load_explicit(&gpio_direct, memory_order_acquire) && gpio_direct_capable(cmds, cmd_count))
+    {
+        // Register accesses come after the messages queued before them
+        if (async)
+        {
+            gpio_async_wait();
+        }
+        gpio_run_direct(cmds, cmd_count);
+        sent = true;
+    }
+    else if (async)
+    {
+        bool queueable = true;
+        for (unsigned i = 0; i < cmd_count; i++)
+        {
+            queueable = queueable && gpio_async_capable(&cmds[i]);
+        }
+
+        if (queueable)
+        {
+            for (unsigned i = 0; i < cmd_count; i++)
+            {
+                gpio_async_push(&cmds[i]);
+                cmds[i].status = EOK;
+            }
+            gpio_async_wake();
+            sent = true;
+        }
+        else
+        {
+            // Commands that return something see the effect of those queued before them
+            gpio_async_wait();
+        }
+    }
+
+    if (!sent && cmd_count > 0)
+    {
+        // Connect to the GPIO resource manager, if not connected already
+        if (gpio_msg_connect())
+        {
+            perror("gpio_msg_connect");
+            for (unsigned i = 0; i < cmd_count; i++)
+            {
+                gpio_shadow_forget(&cmds[i]);
+            }
+            if (configuring)
+            {
+                pthread_mutex_unlock(&gpio_config_mutex);
+            }
+            return GPIO_ERROR_NOT_CONNECTED;
+        }
+
+        gpio_send_cmds(cmds, cmd_count);
+    }
+
+    if (configuring)
+    {
+        pthread_mutex_unlock(&gpio_config_mutex);
+    }
+
+    for (unsigned i = 0; i < cmd_count; i++)
+    {
+        ops[cmd_op[i]].status = gpio_op_decode(&ops[cmd_op[i]], &cmds[i]);
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (ops[i].status != GPIO_SUCCESS)
+        {
+            status = ops[i].status;
+            break;
+        }
+    }
+
+    return status;
+}
+
+int rpi_gpio_cleanup()
+{
+    // The I/O thread sends over the connections closed below
+    int status = rpi_gpio_async_stop();
+
+    pthread_mutex_lock(&gpio_fd_mutex);
+
+    // Disconnect, so that a later call connects again
+    int fd = atomic_exchange_explicit(&gpio_fd, -1, memory_order_relaxed);
+    if (fd != -1 && close(fd))
+    {
+        perror("close");
+        status = GPIO_ERROR_CLEANING_UP;
+    }
+
+    // Close the connections of every thread; each opens a new one when it next
+    // sends, even if opening one failed before
+    for (gpio_thread_conn_t *conn = gpio_thread_conns; conn != NULL; conn = conn->next)
+    {
+        atomic_store_explicit(&conn->failed, false, memory_order_relaxed);
+        int thread_fd = atomic_exchange_explicit(&conn->fd, -1, memory_order_relaxed);
+        if (thread_fd != -1 && close(thread_fd))
+        {
+            perror("close");
+            status = GPIO_ERROR_CLEANING_UP;
+        }
+    }
+
+    pthread_mutex_unlock(&gpio_fd_mutex);
+
+    rpi_gpio_invalidate(GPIO_PIN_ALL);
+
+    if (rpi_gpio_disable_direct())
+    {
+        status = GPIO_ERROR_CLEANING_UP;
+    }
+
+    return status;
+}
+
+int rpi_gpio_enable_direct(uintptr_t peripheral_base)
+{
+    int status = GPIO_SUCCESS;
+
+    pthread_mutex_lock(&gpio_fd_mutex);
+
+    // Map the registers once; later calls find them mapped
+    if (!rpi_gpio_map_regs(peripheral_base))
+    {
+        perror("mmap");
+        status = GPIO_ERROR_NOT_MAPPED;
+    }
+    else
+    {
+        atomic_store_explicit(&gpio_direct, true, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&gpio_fd_mutex);
+
+    return status;
 }
 
-// Register an event with the GPIO resource manager
-static int gpio_msg_register_event(struct sigevent *event)
+int rpi_gpio_disable_direct()
 {
-    pthread_mutex_lock(&gpio_fd_mutex);
-
-    int status = MsgRegisterEvent(event, gpio_fd);
+    int status = GPIO_SUCCESS;
 
-    pthread_mutex_unlock(&gpio_fd_mutex);
+    pthread_mutex_lock(&gpio_fd_mutex);
 
-    if (status != GPIO_SUCCESS)
+    atomic_store_explicit(&gpio_direct, false, memory_order_relaxed);
+    if (!rpi_gpio_unmap_regs())
     {
-        perror("MsgRegisterEvent");
-        return GPIO_ERROR_MSG_EVENT_NOT_REGISTERED;
+        perror("munmap");
+        status = GPIO_ERROR_CLEANING_UP;
     }
+    rpi_gpio_regs = NULL;
 
-    return GPIO_SUCCESS;
+    pthread_mutex_unlock(&gpio_fd_mutex);
+
+    return status;
 }
 
-int rpi_gpio_cleanup()
+int rpi_gpio_async_start()
 {
     int status = GPIO_SUCCESS;
 
     pthread_mutex_lock(&gpio_fd_mutex);
 
-    if (gpio_fd != -1)
+    if (atomic_load(&gpio_async_running))
     {
-        status = close(gpio_fd);
-        if (status)
+        pthread_mutex_unlock(&gpio_fd_mutex);
+        return GPIO_SUCCESS;
+    }
+
+    // Every slot starts free at its own position
+    for (unsigned i = 0; i < GPIO_ASYNC_QUEUE_SIZE; i++)
+    {
+        atomic_init(&gpio_async_slots[i].sequence, i);
+    }
+    atomic_store(&gpio_async_tail, 0);
+    atomic_store(&gpio_async_done, 0);
+    gpio_async_head = 0;
+    atomic_store(&gpio_async_error, GPIO_SUCCESS);
+    atomic_store(&gpio_async_sleeping, false);
+
+    gpio_async_chid = ChannelCreate(_NTO_CHF_PRIVATE);
+    if (gpio_async_chid == -1)
+    {
+        perror("ChannelCreate");
+        pthread_mutex_unlock(&gpio_fd_mutex);
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    gpio_async_coid = ConnectAttach(0, 0, gpio_async_chid, _NTO_SIDE_CHANNEL, 0);
+    if (gpio_async_coid == -1)
+    {
+        perror("ConnectAttach");
+        status = GPIO_ERROR_NO_RESOURCES;
+    }
+    else
+    {
+        atomic_store(&gpio_async_running, true);
+        if (pthread_create(&gpio_async_tid, NULL, gpio_async_thread, NULL))
         {
-            perror("close");
-            status = GPIO_ERROR_CLEANING_UP;
+            perror("pthread_create");
+            atomic_store(&gpio_async_running, false);
+            status = GPIO_ERROR_NO_RESOURCES;
+        }
+    }
+
+    if (status != GPIO_SUCCESS)
+    {
+        if (gpio_async_coid != -1)
+        {
+            ConnectDetach(gpio_async_coid);
+            gpio_async_coid = -1;
         }
+        ChannelDestroy(gpio_async_chid);
+        gpio_async_chid = -1;
     }
 
     pthread_mutex_unlock(&gpio_fd_mutex);
@@ -124,98 +1246,101 @@ int rpi_gpio_cleanup()
     return status;
 }
 
-int rpi_gpio_setup(int gpio_pin, unsigned configuration)
+int rpi_gpio_flush()
 {
-    // Connect to the GPIO resource manager, if not connected already
-    if (gpio_msg_connect())
+    if (atomic_load_explicit(&gpio_async_running, memory_order_relaxed))
     {
-        perror("gpio_msg_connect");
-        return GPIO_ERROR_NOT_CONNECTED;
+        gpio_async_wait();
     }
 
-    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
+    return atomic_exchange(&gpio_async_error, GPIO_SUCCESS);
+}
+
+int rpi_gpio_async_stop()
+{
+    pthread_mutex_lock(&gpio_fd_mutex);
+
+    if (!atomic_load(&gpio_async_running))
     {
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+        pthread_mutex_unlock(&gpio_fd_mutex);
+        return GPIO_SUCCESS;
     }
 
-    // Configure as an input or output.
-    rpi_gpio_msg_t msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_SET_SELECT,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin};
+    // The I/O thread sends what is left in the queue before it exits
+    atomic_store(&gpio_async_running, false);
+    atomic_store(&gpio_async_sleeping, false);
+    MsgSendPulse(gpio_async_coid, -1, GPIO_ASYNC_PULSE_WAKE, 0);
 
-    switch (configuration)
-    {
-    case GPIO_IN:
-        msg.value = RPI_GPIO_FUNC_IN;
-        break;
+    pthread_mutex_unlock(&gpio_fd_mutex);
 
-    case GPIO_OUT:
-        msg.value = RPI_GPIO_FUNC_OUT;
-        break;
+    pthread_join(gpio_async_tid, NULL);
 
-    default:
+    pthread_mutex_lock(&gpio_fd_mutex);
+    ConnectDetach(gpio_async_coid);
+    ChannelDestroy(gpio_async_chid);
+    gpio_async_coid = -1;
+    gpio_async_chid = -1;
+    pthread_mutex_unlock(&gpio_fd_mutex);
+
+    return atomic_exchange(&gpio_async_error, GPIO_SUCCESS);
+}
+
+int rpi_gpio_invalidate(int gpio_pin)
+{
+    if (gpio_pin != GPIO_PIN_ALL && (gpio_pin < 0 || gpio_pin >= GPIO_COUNT))
+    {
         return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-        break;
-    };
+    }
 
-    if (gpio_send_msg(&msg, sizeof(msg)))
+    pthread_mutex_lock(&gpio_shadow_mutex);
+
+    if (gpio_pin == GPIO_PIN_ALL)
     {
-        perror("gpio_send_msg(inout)");
-        return GPIO_ERROR_MSG_NOT_SENT;
+        memset(gpio_shadow, 0, sizeof(gpio_shadow));
+    }
+    else
+    {
+        memset(&gpio_shadow[gpio_pin], 0, sizeof(gpio_shadow[gpio_pin]));
     }
 
+    pthread_mutex_unlock(&gpio_shadow_mutex);
+
     return GPIO_SUCCESS;
 }
 
-int rpi_gpio_setup_pull(int gpio_pin, unsigned configuration, unsigned direction)
+int rpi_gpio_set_concurrency(unsigned policy)
 {
-    // Configure as an input or output.
-    if (rpi_gpio_setup(gpio_pin, configuration))
-    {
-        perror("rpi_gpio_setup");
-        return GPIO_ERROR_NOT_CONNECTED;
-    }
-
-    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
+    if (policy != GPIO_CONCURRENCY_SERIALISED && policy != GPIO_CONCURRENCY_SHARED &&
+        policy != GPIO_CONCURRENCY_PER_THREAD)
     {
         return GPIO_ERROR_INPUT_OUT_OF_RANGE;
     }
 
-    // Configure as pull up or down
-    rpi_gpio_msg_t msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_PUD,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin};
-
-    switch (direction)
-    {
-    case GPIO_PUD_OFF:
-        msg.value = RPI_GPIO_PUD_OFF;
-        break;
+    atomic_store_explicit(&gpio_concurrency, policy, memory_order_relaxed);
 
-    case GPIO_PUD_UP:
-        msg.value = RPI_GPIO_PUD_UP;
-        break;
+    return GPIO_SUCCESS;
+}
 
-    case GPIO_PUD_DOWN:
-        msg.value = RPI_GPIO_PUD_DOWN;
-        break;
+int rpi_gpio_setup(int gpio_pin, unsigned configuration)
+{
+    // Configure as an input or output.
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_SETUP,
+        .gpio_pin = gpio_pin,
+        .value = configuration};
 
-    default:
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-        break;
-    };
+    return gpio_run_ops(&op, 1);
+}
 
-    if (gpio_send_msg(&msg, sizeof(msg)))
-    {
-        perror("gpio_send_msg(pud)");
-        return GPIO_ERROR_MSG_NOT_SENT;
-    }
+int rpi_gpio_setup_pull(int gpio_pin, unsigned configuration, unsigned direction)
+{
+    // Configure as an input or output, then as pull up or down, in one batch;
+    // each change still goes to the resource manager in a message of its own
+    rpi_gpio_op_t ops[2] = {
+        {.op = GPIO_OP_SETUP, .gpio_pin = gpio_pin, .value = configuration},
+        {.op = GPIO_OP_PULL, .gpio_pin = gpio_pin, .value = direction}};
 
-    return GPIO_SUCCESS;
+    return gpio_run_ops(ops, 2);
 }
 
 int rpi_gpio_get_setup(int gpio_pin, unsigned *configuration)
@@ -239,12 +1364,27 @@ int rpi_gpio_get_setup(int gpio_pin, unsigned *configuration)
         .hdr.mgrid = RPI_GPIO_IOMGR,
         .gpio = gpio_pin};
 
+    // Hold off other threads' configuration until the answer is in the shadow
+    pthread_mutex_lock(&gpio_config_mutex);
     if (gpio_send_receive_msg(&msg, sizeof(msg)))
     {
+        pthread_mutex_unlock(&gpio_config_mutex);
         perror("gpio_send_receive_msg(get_inout)");
         return GPIO_ERROR_MSG_NOT_SENT;
     }
 
+    // Remember the function, so setting it again is skipped
+    pthread_mutex_lock(&gpio_shadow_mutex);
+    if (!gpio_shadow[gpio_pin].function_known || gpio_shadow[gpio_pin].function != msg.value)
+    {
+        gpio_shadow[gpio_pin].function_known = true;
+        gpio_shadow[gpio_pin].function = msg.value;
+        gpio_shadow[gpio_pin].pwm_known = false;
+        gpio_shadow[gpio_pin].duty_known = false;
+    }
+    pthread_mutex_unlock(&gpio_shadow_mutex);
+    pthread_mutex_unlock(&gpio_config_mutex);
+
     switch (msg.value)
     {
     case RPI_GPIO_FUNC_IN:
@@ -265,93 +1405,29 @@ int rpi_gpio_get_setup(int gpio_pin, unsigned *configuration)
 
 int rpi_gpio_output(int gpio_pin, unsigned level)
 {
-    // Connect to the GPIO resource manager, if not connected already
-    if (gpio_msg_connect())
-    {
-        perror("gpio_msg_connect");
-        return GPIO_ERROR_NOT_CONNECTED;
-    }
-
-    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
-    {
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-    }
-
     // Set the pin high or low
-    rpi_gpio_msg_t msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_WRITE,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin};
-
-    switch (level)
-    {
-    case GPIO_LOW:
-        msg.value = 0;
-        break;
-
-    case GPIO_HIGH:
-        msg.value = 1;
-        break;
-
-    default:
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-        break;
-    };
-
-    if (gpio_send_msg(&msg, sizeof(msg)))
-    {
-        perror("gpio_send_msg(level)");
-        return GPIO_ERROR_MSG_NOT_SENT;
-    }
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_OUTPUT,
+        .gpio_pin = gpio_pin,
+        .value = level};
 
-    return GPIO_SUCCESS;
+    return gpio_run_ops(&op, 1);
 }
 
 int rpi_gpio_input(int gpio_pin, unsigned *level)
 {
-    // Connect to the GPIO resource manager, if not connected already
-    if (gpio_msg_connect())
-    {
-        perror("gpio_msg_connect");
-        return GPIO_ERROR_NOT_CONNECTED;
-    }
-
-    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
-    {
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-    }
-
     // Query whether pin is high or low
-    rpi_gpio_msg_t msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_READ,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin,
-        .value = 1};
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_INPUT,
+        .gpio_pin = gpio_pin};
 
-    if (gpio_send_receive_msg(&msg, sizeof(msg)))
+    int status = gpio_run_ops(&op, 1);
+    if (status == GPIO_SUCCESS)
     {
-        perror("gpio_send_receive_msg(get_highlow)");
-        return GPIO_ERROR_MSG_NOT_SENT;
+        *level = op.value;
     }
 
-    switch (msg.value)
-    {
-    case 0:
-        *level = GPIO_LOW;
-        break;
-
-    case 1:
-        *level = GPIO_HIGH;
-        break;
-
-    default:
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-        break;
-    };
-
-    return GPIO_SUCCESS;
+    return status;
 }
 
 int rpi_gpio_add_event_detect(int gpio_pin, int coid, unsigned event, unsigned event_id)
@@ -393,7 +1469,6 @@ int rpi_gpio_add_event_detect(int gpio_pin, int coid, unsigned event, unsigned e
     {
         event_msg.detect |= RPI_EVENT_LEVEL_LOW;
     }
-    printf("event_msg.detect: %d\n", event_msg.detect);
 
     if (event_msg.detect == 0)
     {
@@ -401,16 +1476,11 @@ int rpi_gpio_add_event_detect(int gpio_pin, int coid, unsigned event, unsigned e
     }
 
     SIGEV_PULSE_INIT(&event_msg.event, coid, -1, _PULSE_CODE_MINAVAIL, event_id);
-    if (gpio_msg_register_event(&event_msg.event))
-    {
-        perror("gpio_send_msg(event)");
-        return GPIO_ERROR_MSG_EVENT_NOT_REGISTERED;
-    }
-
-    if (gpio_send_msg(&event_msg, sizeof(event_msg)))
+    int status = gpio_msg_register_event(&event_msg);
+    if (status)
     {
-        perror("gpio_send_msg(event)");
-        return GPIO_ERROR_MSG_NOT_SENT;
+        perror("gpio_msg_register_event");
+        return status;
     }
 
     return GPIO_SUCCESS;
@@ -418,78 +1488,133 @@ int rpi_gpio_add_event_detect(int gpio_pin, int coid, unsigned event, unsigned e
 
 int rpi_gpio_setup_pwm(int gpio_pin, unsigned frequency, unsigned mode)
 {
-    // Connect to the GPIO resource manager, if not connected already
-    if (gpio_msg_connect())
-    {
-        perror("gpio_msg_connect");
-        return GPIO_ERROR_NOT_CONNECTED;
-    }
+    // Configure as PWM
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_SETUP_PWM,
+        .gpio_pin = gpio_pin,
+        .value = mode,
+        .frequency = frequency};
 
-    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
-    {
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-    }
+    return gpio_run_ops(&op, 1);
+}
 
-    // Configure as PWM
-    rpi_gpio_pwm_t pwm_msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_PWM_SETUP,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin,
-        .frequency = frequency,
-        .range = 1024};
+int rpi_gpio_set_pwm_duty_cycle(int gpio_pin, float percentage)
+{
+    // Set duty cycle
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_PWM_DUTY,
+        .gpio_pin = gpio_pin,
+        .percentage = percentage};
 
-    switch (mode)
-    {
-    case GPIO_PWM_MODE_PWM:
-        pwm_msg.mode = RPI_PWM_MODE_PWM;
-        break;
+    return gpio_run_ops(&op, 1);
+}
 
-    case GPIO_PWM_MODE_MS:
-        pwm_msg.mode = RPI_PWM_MODE_MS;
-        break;
+int rpi_gpio_write_mask(uint32_t mask, uint32_t levels)
+{
+    // Set and clear the pins in mask at once
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_WRITE_MASK,
+        .mask = mask,
+        .value = levels};
 
-    default:
-        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
-        break;
-    };
+    return gpio_run_ops(&op, 1);
+}
 
-    if (gpio_send_msg(&pwm_msg, sizeof(pwm_msg)))
+int rpi_gpio_read_all(uint32_t *levels)
+{
+    // Sample every pin at once
+    rpi_gpio_op_t op = {
+        .op = GPIO_OP_READ_ALL};
+
+    int status = gpio_run_ops(&op, 1);
+    if (status == GPIO_SUCCESS)
     {
-        perror("gpio_send_msg(pwm)");
-        return GPIO_ERROR_MSG_NOT_SENT;
+        *levels = op.value;
     }
 
-    return GPIO_SUCCESS;
+    return status;
 }
 
-int rpi_gpio_set_pwm_duty_cycle(int gpio_pin, float percentage)
+void rpi_gpio_batch_init(rpi_gpio_batch_t *batch)
 {
-    // Connect to the GPIO resource manager, if not connected already
-    if (gpio_msg_connect())
-    {
-        perror("gpio_msg_connect");
-        return GPIO_ERROR_NOT_CONNECTED;
-    }
+    batch->count = 0;
+}
 
-    if (percentage < 0.0 || percentage > 100.0)
+// Append an operation to a batch
+static int gpio_batch_add(rpi_gpio_batch_t *batch, const rpi_gpio_op_t *op)
+{
+    if (batch->count >= GPIO_BATCH_MAX)
     {
         return GPIO_ERROR_INPUT_OUT_OF_RANGE;
     }
 
-    // Set duty cycle
-    rpi_gpio_msg_t msg = {
-        .hdr.type = _IO_MSG,
-        .hdr.subtype = RPI_GPIO_PWM_DUTY,
-        .hdr.mgrid = RPI_GPIO_IOMGR,
-        .gpio = gpio_pin,
-        .value = (int)(percentage * 1024.0 / 100.0)};
+    batch->ops[batch->count] = *op;
+
+    return batch->count++;
+}
+
+int rpi_gpio_batch_add_setup(rpi_gpio_batch_t *batch, int gpio_pin, unsigned configuration)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_SETUP, .gpio_pin = gpio_pin, .value = configuration};
+
+    return gpio_batch_add(batch, &op);
+}
 
-    if (gpio_send_msg(&msg, sizeof(msg)))
+int rpi_gpio_batch_add_pull(rpi_gpio_batch_t *batch, int gpio_pin, unsigned direction)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_PULL, .gpio_pin = gpio_pin, .value = direction};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_output(rpi_gpio_batch_t *batch, int gpio_pin, unsigned level)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_OUTPUT, .gpio_pin = gpio_pin, .value = level};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_input(rpi_gpio_batch_t *batch, int gpio_pin)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_INPUT, .gpio_pin = gpio_pin};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_setup_pwm(rpi_gpio_batch_t *batch, int gpio_pin, unsigned frequency, unsigned mode)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_SETUP_PWM, .gpio_pin = gpio_pin, .value = mode, .frequency = frequency};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_pwm_duty_cycle(rpi_gpio_batch_t *batch, int gpio_pin, float percentage)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_PWM_DUTY, .gpio_pin = gpio_pin, .percentage = percentage};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_write_mask(rpi_gpio_batch_t *batch, uint32_t mask, uint32_t levels)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_WRITE_MASK, .mask = mask, .value = levels};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_add_read_all(rpi_gpio_batch_t *batch)
+{
+    rpi_gpio_op_t op = {.op = GPIO_OP_READ_ALL};
+
+    return gpio_batch_add(batch, &op);
+}
+
+int rpi_gpio_batch_submit(rpi_gpio_batch_t *batch)
+{
+    if (batch->count > GPIO_BATCH_MAX)
     {
-        perror("gpio_send_msg(pwm_duty)");
-        return GPIO_ERROR_MSG_NOT_SENT;
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
     }
 
-    return GPIO_SUCCESS;
+    return gpio_run_ops(batch->ops, batch->count);
 }
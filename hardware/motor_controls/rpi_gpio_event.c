@@ -0,0 +1,576 @@
+/*
+ * Copyright (c) 2025, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/neutrino.h>
+#include <time.h>
+#include "public/rpi_gpio.h"
+
+// Pulse code the resource manager uses for events (see rpi_gpio_add_event_detect)
+#define GPIO_EVENT_PULSE_EDGE _PULSE_CODE_MINAVAIL
+
+// Pulse code asking the dispatcher to report that it is done with every
+// pulse sent before it
+#define GPIO_EVENT_PULSE_SYNC (_PULSE_CODE_MINAVAIL + 1)
+
+// Event IDs carry the pin and the edge: base + pin * 2, plus one for falling
+#define GPIO_EVENT_ID_BASE 0x67000
+#define GPIO_EVENT_ID(pin, edge) (GPIO_EVENT_ID_BASE + (pin) * 2 + ((edge) == GPIO_FALLING))
+
+// Marks a pin with no transition waiting to settle
+#define GPIO_EVENT_NO_DEADLINE UINT64_MAX
+
+// Edges of one pin. The ring has a single producer, the dispatcher thread,
+// and a single consumer, the thread polling or waiting on the pin.
+//
+// A filtered pin follows its level through both edges. An edge away from the
+// last reported level starts a pending transition, which is reported once
+// the level has held for settle_ns since the last edge and for min_pulse_ns
+// since the transition started; an edge back to the reported level cancels
+// it. Only the dispatcher thread touches the filter state once the pin is
+// enabled.
+//
+// registered holds the edges registered with the resource manager. They stay
+// registered for the life of the process, as there is no message to remove
+// them, so each is registered only once.
+typedef struct
+{
+    rpi_gpio_edge_t ring[GPIO_EVENT_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+    unsigned dropped;
+    atomic_uint edges;
+    unsigned registered;
+    rpi_gpio_edge_callback_t callback;
+    void *arg;
+    atomic_int waiters;
+    bool filtered;
+    uint64_t settle_ns;
+    uint64_t min_pulse_ns;
+    bool reported_high;
+    bool raw_high;
+    rpi_gpio_edge_t pending;
+    uint64_t deadline_ns;
+} gpio_event_pin_t;
+
+static gpio_event_pin_t gpio_event_pins[GPIO_COUNT];
+
+// Serialises starting, stopping and enabling pins
+static pthread_mutex_t gpio_event_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Threads in rpi_gpio_event_wait sleep on gpio_event_cond, which runs on
+// the monotonic clock and is set up once
+static pthread_mutex_t gpio_event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gpio_event_cond;
+static pthread_once_t gpio_event_cond_once = PTHREAD_ONCE_INIT;
+
+// The dispatcher thread and the channel it receives pulses on. Once started
+// they last for the life of the process, since the resource manager keeps
+// sending the events registered on the channel.
+static atomic_bool gpio_event_running = false;
+static pthread_t gpio_event_tid;
+static int gpio_event_chid = -1;
+static int gpio_event_coid = -1;
+
+// Sync pulses sent, under gpio_event_lock, and handled by the dispatcher,
+// which signals gpio_event_cond
+static unsigned gpio_event_sync_sent;
+static atomic_uint gpio_event_synced;
+
+static void gpio_event_cond_init()
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&gpio_event_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Add an edge to its pin's ring, or count it as dropped if the ring is full
+static void gpio_event_push(gpio_event_pin_t *pin, const rpi_gpio_edge_t *edge)
+{
+    unsigned head = atomic_load_explicit(&pin->head, memory_order_relaxed);
+
+    if (head - atomic_load_explicit(&pin->tail, memory_order_acquire) == GPIO_EVENT_QUEUE_SIZE)
+    {
+        pin->dropped++;
+        return;
+    }
+
+    rpi_gpio_edge_t *slot = &pin->ring[head % GPIO_EVENT_QUEUE_SIZE];
+    *slot = *edge;
+    slot->dropped = pin->dropped;
+    pin->dropped = 0;
+    atomic_store_explicit(&pin->head, head + 1, memory_order_release);
+
+    // The edge must be visible before the waiter count is read
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&pin->waiters, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&gpio_event_mutex);
+        pthread_cond_broadcast(&gpio_event_cond);
+        pthread_mutex_unlock(&gpio_event_mutex);
+    }
+}
+
+// Take the oldest edge from a pin's ring. Returns false if it is empty.
+static bool gpio_event_pop(gpio_event_pin_t *pin, rpi_gpio_edge_t *edge)
+{
+    unsigned tail = atomic_load_explicit(&pin->tail, memory_order_relaxed);
+
+    if (tail == atomic_load_explicit(&pin->head, memory_order_acquire))
+    {
+        return false;
+    }
+
+    *edge = pin->ring[tail % GPIO_EVENT_QUEUE_SIZE];
+    atomic_store_explicit(&pin->tail, tail + 1, memory_order_release);
+
+    return true;
+}
+
+// Hand an edge to the pin's callback, or queue it
+static void gpio_event_deliver(gpio_event_pin_t *pin, const rpi_gpio_edge_t *edge)
+{
+    if (pin->callback != NULL)
+    {
+        pin->callback(edge, pin->arg);
+    }
+    else
+    {
+        gpio_event_push(pin, edge);
+    }
+}
+
+// Track the level of a filtered pin through one of its edges
+static void gpio_event_filter(gpio_event_pin_t *pin, const rpi_gpio_edge_t *edge)
+{
+    pin->raw_high = (edge->edge == GPIO_RISING);
+
+    // Back to the reported level: whatever was pending was a bounce or a glitch
+    if (pin->raw_high == pin->reported_high)
+    {
+        pin->deadline_ns = GPIO_EVENT_NO_DEADLINE;
+        return;
+    }
+
+    // The transition keeps the stamp of the edge that started it
+    if (pin->deadline_ns == GPIO_EVENT_NO_DEADLINE)
+    {
+        pin->pending = *edge;
+    }
+
+    uint64_t settled = edge->time_ns + pin->settle_ns;
+    uint64_t long_enough = pin->pending.time_ns + pin->min_pulse_ns;
+    pin->deadline_ns = (settled > long_enough) ? settled : long_enough;
+}
+
+// Report the pending transitions that have settled by now_ns. Returns the
+// earliest deadline still to come.
+static uint64_t gpio_event_settle(uint64_t now_ns)
+{
+    uint64_t next = GPIO_EVENT_NO_DEADLINE;
+
+    for (int i = 0; i < GPIO_COUNT; i++)
+    {
+        gpio_event_pin_t *pin = &gpio_event_pins[i];
+
+        if (!atomic_load_explicit(&pin->edges, memory_order_acquire) || !pin->filtered)
+        {
+            continue;
+        }
+        if (pin->deadline_ns > now_ns)
+        {
+            if (pin->deadline_ns < next)
+            {
+                next = pin->deadline_ns;
+            }
+            continue;
+        }
+
+        pin->deadline_ns = GPIO_EVENT_NO_DEADLINE;
+        pin->reported_high = pin->raw_high;
+        pin->pending.edge = pin->raw_high ? GPIO_RISING : GPIO_FALLING;
+        if (atomic_load_explicit(&pin->edges, memory_order_relaxed) & pin->pending.edge)
+        {
+            gpio_event_deliver(pin, &pin->pending);
+        }
+    }
+
+    return next;
+}
+
+// Read the monotonic clock in nanoseconds
+static uint64_t gpio_event_now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Receive event pulses, stamp them and hand them to their pin. While
+// transitions of filtered pins are pending, the receive times out at the
+// first of their deadlines.
+static void *gpio_event_thread(void *arg)
+{
+    struct _pulse pulse;
+    uint64_t deadline = GPIO_EVENT_NO_DEADLINE;
+
+    for (;;)
+    {
+        if (deadline != GPIO_EVENT_NO_DEADLINE)
+        {
+            uint64_t now = gpio_event_now_ns();
+            uint64_t timeout = (deadline > now) ? (deadline - now) : 0;
+            TimerTimeout(CLOCK_MONOTONIC, _NTO_TIMEOUT_RECEIVE, NULL, &timeout, NULL);
+        }
+
+        int received = MsgReceivePulse(gpio_event_chid, &pulse, sizeof(pulse), NULL);
+
+        // Stamp first, so that the time is as close to the edge as possible
+        rpi_gpio_edge_t edge;
+        edge.cycles = ClockCycles();
+        edge.time_ns = gpio_event_now_ns();
+
+        if (received == -1)
+        {
+            if (errno != ETIMEDOUT && errno != EINTR)
+            {
+                perror("MsgReceivePulse");
+                break;
+            }
+        }
+        else if (pulse.code == GPIO_EVENT_PULSE_SYNC)
+        {
+            pthread_mutex_lock(&gpio_event_mutex);
+            atomic_fetch_add(&gpio_event_synced, 1);
+            pthread_cond_broadcast(&gpio_event_cond);
+            pthread_mutex_unlock(&gpio_event_mutex);
+        }
+        else if (pulse.code == GPIO_EVENT_PULSE_EDGE)
+        {
+            int id = pulse.value.sival_int - GPIO_EVENT_ID_BASE;
+            if (id >= 0 && id < GPIO_COUNT * 2)
+            {
+                edge.gpio_pin = id / 2;
+                edge.edge = (id & 1) ? GPIO_FALLING : GPIO_RISING;
+                edge.dropped = 0;
+
+                // Edges still in flight for a pin that is no longer enabled are ignored
+                gpio_event_pin_t *pin = &gpio_event_pins[edge.gpio_pin];
+                unsigned edges = atomic_load_explicit(&pin->edges, memory_order_acquire);
+                if (edges && pin->filtered)
+                {
+                    gpio_event_filter(pin, &edge);
+                }
+                else if (edges & edge.edge)
+                {
+                    gpio_event_deliver(pin, &edge);
+                }
+            }
+        }
+
+        deadline = gpio_event_settle(edge.time_ns);
+    }
+
+    return NULL;
+}
+
+int rpi_gpio_events_start(int priority)
+{
+    pthread_once(&gpio_event_cond_once, gpio_event_cond_init);
+
+    pthread_mutex_lock(&gpio_event_lock);
+
+    // A running dispatcher only takes the new priority
+    if (atomic_load(&gpio_event_running))
+    {
+        int status = 0;
+        if (priority > 0)
+        {
+            struct sched_param param = {.sched_priority = priority};
+            status = pthread_setschedparam(gpio_event_tid, SCHED_FIFO, &param);
+            if (status)
+            {
+                errno = status;
+                perror("pthread_setschedparam");
+            }
+        }
+        pthread_mutex_unlock(&gpio_event_lock);
+        return status ? GPIO_ERROR_NO_RESOURCES : GPIO_SUCCESS;
+    }
+
+    // A fixed priority channel keeps the thread at its own priority, whatever
+    // the priority of the pulses
+    gpio_event_chid = ChannelCreate(_NTO_CHF_PRIVATE | _NTO_CHF_FIXED_PRIORITY);
+    if (gpio_event_chid == -1)
+    {
+        perror("ChannelCreate");
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    gpio_event_coid = ConnectAttach(0, 0, gpio_event_chid, _NTO_SIDE_CHANNEL, 0);
+    if (gpio_event_coid == -1)
+    {
+        perror("ConnectAttach");
+        ChannelDestroy(gpio_event_chid);
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (priority > 0)
+    {
+        struct sched_param param = {.sched_priority = priority};
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    int status = pthread_create(&gpio_event_tid, &attr, gpio_event_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (status)
+    {
+        errno = status;
+        perror("pthread_create");
+        ConnectDetach(gpio_event_coid);
+        ChannelDestroy(gpio_event_chid);
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    atomic_store(&gpio_event_running, true);
+
+    pthread_mutex_unlock(&gpio_event_lock);
+
+    return GPIO_SUCCESS;
+}
+
+int rpi_gpio_events_stop()
+{
+    pthread_mutex_lock(&gpio_event_lock);
+
+    if (!atomic_load(&gpio_event_running))
+    {
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_SUCCESS;
+    }
+
+    // Pulses for disabled pins are ignored from now on
+    for (int i = 0; i < GPIO_COUNT; i++)
+    {
+        atomic_store(&gpio_event_pins[i].edges, 0);
+    }
+
+    // Wait for the dispatcher to finish with the pulses it already has, so
+    // that nothing it uses changes under it
+    unsigned target = ++gpio_event_sync_sent;
+    if (MsgSendPulse(gpio_event_coid, -1, GPIO_EVENT_PULSE_SYNC, 0) == -1)
+    {
+        perror("MsgSendPulse");
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_MSG_NOT_SENT;
+    }
+    pthread_mutex_lock(&gpio_event_mutex);
+    while ((int)(atomic_load(&gpio_event_synced) - target) < 0)
+    {
+        pthread_cond_wait(&gpio_event_cond, &gpio_event_mutex);
+    }
+    pthread_mutex_unlock(&gpio_event_mutex);
+
+    for (int i = 0; i < GPIO_COUNT; i++)
+    {
+        gpio_event_pin_t *pin = &gpio_event_pins[i];
+        pin->callback = NULL;
+        pin->arg = NULL;
+        atomic_store(&pin->tail, atomic_load(&pin->head));
+        pin->dropped = 0;
+        pin->filtered = false;
+    }
+
+    pthread_mutex_unlock(&gpio_event_lock);
+
+    return GPIO_SUCCESS;
+}
+
+int rpi_gpio_event_enable(int gpio_pin, unsigned edges, rpi_gpio_edge_callback_t callback, void *arg)
+{
+    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT || edges == 0 || (edges & ~(GPIO_RISING | GPIO_FALLING)))
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    // Start the dispatcher at the caller's priority if it is not running yet
+    int status = rpi_gpio_events_start(0);
+    if (status)
+    {
+        return status;
+    }
+
+    pthread_mutex_lock(&gpio_event_lock);
+
+    gpio_event_pin_t *pin = &gpio_event_pins[gpio_pin];
+    if (atomic_load(&pin->edges))
+    {
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    // A filter follows the level, so it needs both edges and a starting level
+    unsigned registered = edges;
+    if (pin->filtered)
+    {
+        unsigned level;
+        status = rpi_gpio_input(gpio_pin, &level);
+        if (status)
+        {
+            pthread_mutex_unlock(&gpio_event_lock);
+            return status;
+        }
+        pin->reported_high = (level == GPIO_HIGH);
+        pin->raw_high = pin->reported_high;
+        pin->deadline_ns = GPIO_EVENT_NO_DEADLINE;
+        registered = GPIO_RISING | GPIO_FALLING;
+    }
+
+    // The callback and filter are in place before the dispatcher can see the
+    // pin enabled
+    pin->callback = callback;
+    pin->arg = arg;
+    atomic_store_explicit(&pin->edges, edges, memory_order_release);
+
+    // One registration per edge, so that the event ID says which edge it was.
+    // Edges registered before, even by an attempt that failed part way, are
+    // not registered again, or their events would arrive twice.
+    static const unsigned edge_list[] = {GPIO_RISING, GPIO_FALLING};
+    for (unsigned i = 0; i < sizeof(edge_list) / sizeof(edge_list[0]); i++)
+    {
+        if ((registered & edge_list[i]) && !(pin->registered & edge_list[i]))
+        {
+            status = rpi_gpio_add_event_detect(gpio_pin, gpio_event_coid, edge_list[i],
+                                               GPIO_EVENT_ID(gpio_pin, edge_list[i]));
+            if (status)
+            {
+                break;
+            }
+            pin->registered |= edge_list[i];
+        }
+    }
+
+    if (status)
+    {
+        atomic_store(&pin->edges, 0);
+    }
+
+    pthread_mutex_unlock(&gpio_event_lock);
+
+    return status;
+}
+
+int rpi_gpio_event_set_filter(int gpio_pin, unsigned settle_us, unsigned min_pulse_us)
+{
+    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    pthread_mutex_lock(&gpio_event_lock);
+
+    // The dispatcher reads the filter without a lock once the pin is enabled
+    gpio_event_pin_t *pin = &gpio_event_pins[gpio_pin];
+    if (atomic_load(&pin->edges))
+    {
+        pthread_mutex_unlock(&gpio_event_lock);
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    pin->filtered = (settle_us > 0 || min_pulse_us > 0);
+    pin->settle_ns = (uint64_t)settle_us * 1000;
+    pin->min_pulse_ns = (uint64_t)min_pulse_us * 1000;
+
+    pthread_mutex_unlock(&gpio_event_lock);
+
+    return GPIO_SUCCESS;
+}
+
+int rpi_gpio_event_poll(int gpio_pin, rpi_gpio_edge_t *edge)
+{
+    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    return gpio_event_pop(&gpio_event_pins[gpio_pin], edge) ? GPIO_SUCCESS : GPIO_ERROR_NO_EVENT;
+}
+
+int rpi_gpio_event_wait(int gpio_pin, rpi_gpio_edge_t *edge, int timeout_ms)
+{
+    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    gpio_event_pin_t *pin = &gpio_event_pins[gpio_pin];
+    if (gpio_event_pop(pin, edge))
+    {
+        return GPIO_SUCCESS;
+    }
+
+    pthread_once(&gpio_event_cond_once, gpio_event_cond_init);
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    // Announce the wait before the last look at the ring, so that an edge
+    // added in between either is seen or wakes this thread
+    int status = GPIO_SUCCESS;
+    atomic_fetch_add(&pin->waiters, 1);
+    pthread_mutex_lock(&gpio_event_mutex);
+    while (!gpio_event_pop(pin, edge))
+    {
+        int error = (timeout_ms >= 0) ? pthread_cond_timedwait(&gpio_event_cond, &gpio_event_mutex, &deadline)
+                                      : pthread_cond_wait(&gpio_event_cond, &gpio_event_mutex);
+        if (error == ETIMEDOUT)
+        {
+            status = gpio_event_pop(pin, edge) ? GPIO_SUCCESS : GPIO_ERROR_NO_EVENT;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&gpio_event_mutex);
+    atomic_fetch_sub(&pin->waiters, 1);
+
+    return status;
+}
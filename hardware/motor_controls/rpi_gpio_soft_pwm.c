@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2025, BlackBerry Limited. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/neutrino.h>
+#include <time.h>
+#include "public/rpi_gpio.h"
+
+// Duty cycles are kept in millionths of the period
+#define GPIO_SOFT_PWM_FULL 1000000u
+
+// Time allowed on top of a clock tick for the engine to be scheduled after
+// its timer fires
+#define GPIO_SOFT_PWM_SLACK_NS 20000
+
+// Falling edges of one period; the channels in mask go low offset_ns after it starts
+typedef struct
+{
+    uint64_t offset_ns;
+    uint32_t mask;
+} gpio_soft_pwm_fall_t;
+
+// Duty cycle of every pin, and the pins driven by the engine
+static atomic_uint gpio_soft_pwm_duty[GPIO_COUNT];
+static atomic_uint gpio_soft_pwm_channels;
+
+// Length of a period, which may change while the engine runs
+static atomic_uint_fast64_t gpio_soft_pwm_period_ns;
+
+// The engine sleeps until this long before an edge, then spins until it is
+// due. Timers only fire on a clock tick, so it covers a tick and the slack.
+static atomic_uint_fast64_t gpio_soft_pwm_spin_ns;
+
+// Serialises starting and stopping the engine and adding channels
+static pthread_mutex_t gpio_soft_pwm_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The engine thread
+static atomic_bool gpio_soft_pwm_running = false;
+static pthread_t gpio_soft_pwm_tid;
+
+// Timing statistics, only written by the engine thread
+static atomic_uint_fast64_t gpio_soft_pwm_edges;
+static atomic_uint_fast64_t gpio_soft_pwm_late_total_ns;
+static atomic_uint_fast64_t gpio_soft_pwm_late_max_ns;
+static atomic_uint_fast64_t gpio_soft_pwm_missed;
+static atomic_uint_fast64_t gpio_soft_pwm_errors;
+
+// Read the monotonic clock in nanoseconds
+static uint64_t gpio_soft_pwm_now_ns()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Wait until a point on the monotonic clock. Returns the time it was reached.
+static uint64_t gpio_soft_pwm_wait_until(uint64_t when_ns)
+{
+    uint64_t spin = atomic_load_explicit(&gpio_soft_pwm_spin_ns, memory_order_relaxed);
+    uint64_t now = gpio_soft_pwm_now_ns();
+
+    if (when_ns > now + spin)
+    {
+        uint64_t wake = when_ns - spin;
+        struct timespec ts = {.tv_sec = wake / 1000000000ULL, .tv_nsec = wake % 1000000000ULL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        {
+        }
+    }
+
+    do
+    {
+        now = gpio_soft_pwm_now_ns();
+    } while (now < when_ns);
+
+    return now;
+}
+
+// Drive pins and account for how late the edge was
+static void gpio_soft_pwm_edge(uint32_t mask, uint32_t levels, uint64_t due_ns, uint64_t now_ns)
+{
+    if (rpi_gpio_write_mask(mask, levels))
+    {
+        atomic_fetch_add_explicit(&gpio_soft_pwm_errors, 1, memory_order_relaxed);
+    }
+
+    uint64_t late = now_ns - due_ns;
+    atomic_fetch_add_explicit(&gpio_soft_pwm_edges, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&gpio_soft_pwm_late_total_ns, late, memory_order_relaxed);
+    if (late > atomic_load_explicit(&gpio_soft_pwm_late_max_ns, memory_order_relaxed))
+    {
+        atomic_store_explicit(&gpio_soft_pwm_late_max_ns, late, memory_order_relaxed);
+    }
+}
+
+// Work out the falling edges of the next period from the duty cycles, in
+// time order, with channels that fall together sharing one edge. Returns the
+// number of edges; channels that stay high or low all period have none.
+static unsigned gpio_soft_pwm_schedule(uint32_t channels, uint64_t period_ns, uint32_t *high,
+                                       gpio_soft_pwm_fall_t *falls)
+{
+    unsigned count = 0;
+
+    *high = 0;
+    for (int pin = 0; pin < GPIO_COUNT; pin++)
+    {
+        if (!(channels & (1u << pin)))
+        {
+            continue;
+        }
+
+        unsigned duty = atomic_load_explicit(&gpio_soft_pwm_duty[pin], memory_order_relaxed);
+        if (duty == 0)
+        {
+            continue;
+        }
+        *high |= 1u << pin;
+        if (duty >= GPIO_SOFT_PWM_FULL)
+        {
+            continue;
+        }
+
+        // Insert in time order, or join an edge at the same time
+        uint64_t offset = period_ns * duty / GPIO_SOFT_PWM_FULL;
+        unsigned i = 0;
+        while (i < count && falls[i].offset_ns < offset)
+        {
+            i++;
+        }
+        if (i < count && falls[i].offset_ns == offset)
+        {
+            falls[i].mask |= 1u << pin;
+            continue;
+        }
+        for (unsigned j = count; j > i; j--)
+        {
+            falls[j] = falls[j - 1];
+        }
+        falls[i].offset_ns = offset;
+        falls[i].mask = 1u << pin;
+        count++;
+    }
+
+    return count;
+}
+
+// Raise every channel at the start of each period and lower each at the end
+// of its pulse. Duty cycle and frequency changes take effect at the next
+// period, so no pulse is cut short.
+static void *gpio_soft_pwm_thread(void *arg)
+{
+    gpio_soft_pwm_fall_t falls[GPIO_COUNT];
+    uint64_t start = gpio_soft_pwm_now_ns();
+
+    while (atomic_load_explicit(&gpio_soft_pwm_running, memory_order_relaxed))
+    {
+        uint64_t period = atomic_load_explicit(&gpio_soft_pwm_period_ns, memory_order_relaxed);
+        uint32_t channels = atomic_load_explicit(&gpio_soft_pwm_channels, memory_order_acquire);
+        uint32_t high;
+        unsigned count = gpio_soft_pwm_schedule(channels, period, &high, falls);
+
+        // Channels at 0% are driven low every period too, in the same write
+        uint64_t now = gpio_soft_pwm_wait_until(start);
+        gpio_soft_pwm_edge(channels, high, start, now);
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            uint64_t due = start + falls[i].offset_ns;
+            uint32_t mask = falls[i].mask;
+            now = gpio_soft_pwm_wait_until(due);
+
+            // Edges that have come due while this one was late go with it
+            while (i + 1 < count && start + falls[i + 1].offset_ns <= now)
+            {
+                mask |= falls[++i].mask;
+            }
+            gpio_soft_pwm_edge(mask, 0, due, now);
+        }
+
+        // After falling a whole period behind, skip the periods missed rather
+        // than cramming them in
+        start += period;
+        now = gpio_soft_pwm_now_ns();
+        if (now > start + period)
+        {
+            uint64_t missed = (now - start) / period;
+            atomic_fetch_add_explicit(&gpio_soft_pwm_missed, missed, memory_order_relaxed);
+            start += missed * period;
+        }
+    }
+
+    return NULL;
+}
+
+int rpi_gpio_soft_pwm_start(unsigned frequency, int priority)
+{
+    if (frequency < 1 || frequency > GPIO_SOFT_PWM_MAX_FREQUENCY)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    struct _clockperiod tick;
+    if (ClockPeriod(CLOCK_REALTIME, NULL, &tick, 0) == -1)
+    {
+        perror("ClockPeriod");
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    // The engine must sleep for part of each period rather than spin through it
+    uint64_t spin = tick.nsec + GPIO_SOFT_PWM_SLACK_NS;
+    uint64_t period = 1000000000ULL / frequency;
+    if (period < 2 * spin)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    pthread_mutex_lock(&gpio_soft_pwm_lock);
+
+    atomic_store(&gpio_soft_pwm_spin_ns, spin);
+    atomic_store(&gpio_soft_pwm_period_ns, period);
+    if (atomic_load(&gpio_soft_pwm_running))
+    {
+        pthread_mutex_unlock(&gpio_soft_pwm_lock);
+        return GPIO_SUCCESS;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (priority > 0)
+    {
+        struct sched_param param = {.sched_priority = priority};
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    atomic_store(&gpio_soft_pwm_running, true);
+    int status = pthread_create(&gpio_soft_pwm_tid, &attr, gpio_soft_pwm_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (status)
+    {
+        errno = status;
+        perror("pthread_create");
+        atomic_store(&gpio_soft_pwm_running, false);
+        pthread_mutex_unlock(&gpio_soft_pwm_lock);
+        return GPIO_ERROR_NO_RESOURCES;
+    }
+
+    pthread_mutex_unlock(&gpio_soft_pwm_lock);
+
+    return GPIO_SUCCESS;
+}
+
+int rpi_gpio_soft_pwm_stop()
+{
+    pthread_mutex_lock(&gpio_soft_pwm_lock);
+
+    if (atomic_load(&gpio_soft_pwm_running))
+    {
+        atomic_store(&gpio_soft_pwm_running, false);
+        pthread_join(gpio_soft_pwm_tid, NULL);
+    }
+
+    // Leave every channel low
+    int status = GPIO_SUCCESS;
+    uint32_t channels = atomic_exchange(&gpio_soft_pwm_channels, 0);
+    if (channels)
+    {
+        status = rpi_gpio_write_mask(channels, 0);
+    }
+    for (int pin = 0; pin < GPIO_COUNT; pin++)
+    {
+        atomic_store(&gpio_soft_pwm_duty[pin], 0);
+    }
+
+    pthread_mutex_unlock(&gpio_soft_pwm_lock);
+
+    return status;
+}
+
+int rpi_gpio_soft_pwm_set_duty_cycle(int gpio_pin, float percentage)
+{
+    if (gpio_pin < 0 || gpio_pin >= GPIO_COUNT || !(percentage >= 0.0f && percentage <= 100.0f))
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    atomic_store_explicit(&gpio_soft_pwm_duty[gpio_pin],
+                          (unsigned)(percentage * (GPIO_SOFT_PWM_FULL / 100) + 0.5f), memory_order_relaxed);
+
+    // Make the pin an output the first time, then hand it to the engine
+    if (!(atomic_load(&gpio_soft_pwm_channels) & (1u << gpio_pin)))
+    {
+        pthread_mutex_lock(&gpio_soft_pwm_lock);
+
+        int status = rpi_gpio_setup(gpio_pin, GPIO_OUT);
+        if (status == GPIO_SUCCESS)
+        {
+            atomic_fetch_or_explicit(&gpio_soft_pwm_channels, 1u << gpio_pin, memory_order_release);
+        }
+
+        pthread_mutex_unlock(&gpio_soft_pwm_lock);
+
+        return status;
+    }
+
+    return GPIO_SUCCESS;
+}
+
+int rpi_gpio_soft_pwm_get_stats(rpi_gpio_soft_pwm_stats_t *stats, bool reset)
+{
+    if (stats == NULL)
+    {
+        return GPIO_ERROR_INPUT_OUT_OF_RANGE;
+    }
+
+    if (reset)
+    {
+        stats->edges = atomic_exchange(&gpio_soft_pwm_edges, 0);
+        stats->late_total_ns = atomic_exchange(&gpio_soft_pwm_late_total_ns, 0);
+        stats->late_max_ns = atomic_exchange(&gpio_soft_pwm_late_max_ns, 0);
+        stats->missed_periods = atomic_exchange(&gpio_soft_pwm_missed, 0);
+        stats->errors = atomic_exchange(&gpio_soft_pwm_errors, 0);
+    }
+    else
+    {
+        stats->edges = atomic_load(&gpio_soft_pwm_edges);
+        stats->late_total_ns = atomic_load(&gpio_soft_pwm_late_total_ns);
+        stats->late_max_ns = atomic_load(&gpio_soft_pwm_late_max_ns);
+        stats->missed_periods = atomic_load(&gpio_soft_pwm_missed);
+        stats->errors = atomic_load(&gpio_soft_pwm_errors);
+    }
+
+    return GPIO_SUCCESS;
+}